@@ -1,4 +1,11 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/i2s.h"
 #include "driver/rtc_io.h"
 
@@ -9,8 +16,68 @@
 #define AUDIO_IO_POSITIVE GPIO_NUM_26
 #define I2S_NUM I2S_NUM_0
 
+#define AUDIO_TASK_CORE (1)
+#define AUDIO_TASK_PRIORITY (6)
+#define AUDIO_TASK_STACK_SIZE (2048)
+/* Frames the feeder hands to I2S at once, one DMA buffer */
+#define AUDIO_CHUNK_FRAMES (64)
+
+/* Both differential outputs at mid scale */
+#define AUDIO_SILENCE ((short)0x8000)
+
+_Static_assert((AUDIO_RING_FRAMES & (AUDIO_RING_FRAMES - 1)) == 0, "AUDIO_RING_FRAMES must be a power of two");
+
 float audio_volume = 1.0f;
 
+/*
+ Single producer, single consumer ring of converted stereo frames. Head and
+ tail count frames and wrap at 2^32: audio_submit() alone moves head, the
+ feeder alone moves tail, and each publishes its end after touching the
+ frames, so neither needs a lock.
+*/
+static short *s_ring = NULL;
+static atomic_uint s_head = 0;
+static atomic_uint s_tail = 0;
+static atomic_uint s_underruns = 0;
+static atomic_uint s_overruns = 0;
+static short s_silence[AUDIO_CHUNK_FRAMES * 2];
+
+static void audio_task(void *arg)
+{
+    bool playing = false;
+    size_t written;
+
+    while (true) {
+        unsigned int tail = atomic_load_explicit(&s_tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&s_head, memory_order_acquire);
+        unsigned int count = head - tail;
+
+        // Keep the DMA fed with silence when the ring runs dry, so it
+        // doesn't replay stale buffers
+        if (count == 0) {
+            if (playing) {
+                atomic_fetch_add_explicit(&s_underruns, 1, memory_order_relaxed);
+                playing = false;
+            }
+            i2s_write(I2S_NUM, s_silence, sizeof(s_silence), &written, portMAX_DELAY);
+            continue;
+        }
+
+        // Write straight from the ring, up to its end
+        unsigned int index = tail & (AUDIO_RING_FRAMES - 1);
+        if (count > AUDIO_RING_FRAMES - index) {
+            count = AUDIO_RING_FRAMES - index;
+        }
+        if (count > AUDIO_CHUNK_FRAMES) {
+            count = AUDIO_CHUNK_FRAMES;
+        }
+
+        i2s_write(I2S_NUM, &s_ring[index * 2], count * 2 * sizeof(short), &written, portMAX_DELAY);
+        atomic_store_explicit(&s_tail, tail + count, memory_order_release);
+        playing = true;
+    }
+}
+
 void audio_init(int audio_sample_rate)
 {
     i2s_config_t i2s_config = {
@@ -29,52 +96,178 @@ void audio_init(int audio_sample_rate)
     i2s_set_pin(I2S_NUM, NULL);
 
     audio_volume = 1.0f;
+
+    s_ring = malloc(AUDIO_RING_FRAMES * 2 * sizeof(short));
+    if (!s_ring) abort();
+
+    for (int i = 0; i < AUDIO_CHUNK_FRAMES * 2; i++) {
+        s_silence[i] = AUDIO_SILENCE;
+    }
+
+    BaseType_t res = xTaskCreatePinnedToCore(audio_task, "audio", AUDIO_TASK_STACK_SIZE, NULL, AUDIO_TASK_PRIORITY, NULL, AUDIO_TASK_CORE);
+    if (res != pdPASS) abort();
 }
 
-void audio_submit(short* buf, int len)
+/* Copy len converted frames into the ring, as many as fit */
+static int audio_push(const short *buf, int len)
 {
-    if (audio_volume == 0.0f) {
-        for (int i = 0; i < len; i += 2) {
-            buf[i] = 0;
+    unsigned int head = atomic_load_explicit(&s_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&s_tail, memory_order_acquire);
+    int room = AUDIO_RING_FRAMES - (head - tail);
+
+    if (len > room) {
+        atomic_fetch_add_explicit(&s_overruns, len - room, memory_order_relaxed);
+        len = room;
+    }
+
+    unsigned int index = head & (AUDIO_RING_FRAMES - 1);
+    int first = len < AUDIO_RING_FRAMES - index ? len : AUDIO_RING_FRAMES - index;
+    memcpy(&s_ring[index * 2], buf, first * 2 * sizeof(short));
+    memcpy(s_ring, buf + first * 2, (len - first) * 2 * sizeof(short));
+
+    atomic_store_explicit(&s_head, head + len, memory_order_release);
+    return len;
+}
+
+/* Reference conversion, for volumes the fixed point path doesn't cover */
+static void audio_convert_float(short *buf, int len)
+{
+    for (int i = 0; i < len * 2; i += 2) {
+        int dac0, dac1;
+
+        /* Down mix stero to mono in sample */
+        int sample = ((int)buf[i] + (int)buf[i + 1]) >> 1;
+
+        /* Normalize */
+        const float normalized = (float)sample / 0x8000;
+
+        /* Scale */
+        const int magnitude = 127 + 127;
+        const float range = magnitude * normalized * audio_volume;
+
+        /* Convert to differential output */
+        if (range > 127) {
+            dac1 = (range - 127);
+            dac0 = 127;
+        }
+        else if (range < -127) {
+            dac1  = (range + 127);
+            dac0 = -127;
+        } else {
+            dac1 = 0;
+            dac0 = range;
         }
-    } else {
-        for (int i = 0; i < len * 2; i += 2) {
-            int dac0, dac1;
 
-            /* Down mix stero to mono in sample */
-            int sample = ((int)buf[i] + (int)buf[i + 1]) >> 1;
+        dac0 += 0x80;
+        dac1 = 0x80 - dac1;
 
-            /* Normalize */
-            const float normalized = (float)sample / 0x8000;
+        dac0 <<= 8;
+        dac1 <<= 8;
 
-            /* Scale */
-            const int magnitude = 127 + 127;
-            const float range = magnitude * normalized * audio_volume;
+        buf[i] = (short)dac1;
+        buf[i + 1] = (short)dac0;
+    }
+}
 
-            /* Convert to differential output */
-            if (range > 127) {
-                dac1 = (range - 127);
-                dac0 = 127;
-            }
-            else if (range < -127) {
-                dac1  = (range + 127);
-                dac0 = -127;
-            } else {
-                dac1 = 0;
-                dac0 = range;
-            }
+/*
+ The float conversion truncates range = fl(254 * sample / 0x8000 * volume).
+ range grows with |sample| and has at most 509 values for volumes up to 2, so
+ the fixed point path keeps, per volume, the smallest |sample| reaching each
+ integer and corrects a 32-bit estimate of range against it.
+
+ With volume = m * 2^e, m a 24-bit integer, the exact product is
+ x = 254 * |sample| * m in units of 2^-(15 - e). Rounding to a float reaches
+ the integer n when x is at most half a float step below it; the step below
+ n in (2^k, 2^(k+1)] is 2^(k - 23), and ties round to even, which is n.
+*/
+#define AUDIO_LEVELS (512)
+
+static float s_levels_volume = 0.0f;
+static uint32_t s_levels_scale;
+static uint16_t s_levels[AUDIO_LEVELS];
+
+static void audio_build_levels(float volume)
+{
+    int exp;
+    const int64_t m = frexpf(volume, &exp) * (1 << 24);
+    const int shift = 15 + 24 - exp;
+
+    // range >= n from this |sample| on, never for the rest
+    s_levels[0] = 0;
+    for (int n = 1; n < AUDIO_LEVELS; n++) {
+        const int k = n > 1 ? 31 - __builtin_clz(n - 1) : -1;
+        const int64_t x = ((int64_t)n << shift) - ((int64_t)1 << (k - 24 + shift));
+        const int64_t level = (x + 254 * m - 1) / (254 * m);
+        s_levels[n] = level < 0xffff ? level : 0xffff;
+    }
+
+    // Estimate at most one below floor(x), so within two of range
+    s_levels_scale = (254 * m) >> (16 - exp);
+    s_levels_volume = volume;
+}
+
+static bool audio_convert_fixed(short *buf, int len, float volume)
+{
+    // Keep the levels within the table and the shifts within 64 bits
+    if (!(fabsf(volume) >= 1.0f / 4096 && fabsf(volume) <= 2.0f)) {
+        return false;
+    }
+
+    if (fabsf(volume) != s_levels_volume) {
+        audio_build_levels(fabsf(volume));
+    }
+
+    const int volume_sign = volume < 0 ? -1 : 0;
+
+    for (int i = 0; i < len * 2; i += 2) {
+        int sample = ((int)buf[i] + (int)buf[i + 1]) >> 1;
 
-            dac0 += 0x80;
-            dac1 = 0x80 - dac1;
+        const int sign = (sample >> 31) ^ volume_sign;
+        const uint32_t a = sample < 0 ? -sample : sample;
 
-            dac0 <<= 8;
-            dac1 <<= 8;
+        int range = (a * s_levels_scale) >> 23;
+        range += (a >= s_levels[range + 1]) + (a >= s_levels[range + 2]);
+        range = (range ^ sign) - sign;
 
-            buf[i] = (short)dac1;
-            buf[i + 1] = (short)dac0;
+        // Differential split, dac1 takes what dac0 can't
+        const int dac0 = range > 127 ? 127 : range < -127 ? -127 : range;
+        const int dac1 = range - dac0;
+
+        buf[i] = (short)((0x80 - dac1) << 8);
+        buf[i + 1] = (short)((dac0 + 0x80) << 8);
+    }
+
+    return true;
+}
+
+void audio_convert(short *buf, int len)
+{
+    if (audio_volume == 0.0f) {
+        for (int i = 0; i < len; i += 2) {
+            buf[i] = 0;
         }
+    } else if (!audio_convert_fixed(buf, len, audio_volume)) {
+        audio_convert_float(buf, len);
     }
+}
 
-    size_t written;
-    i2s_write(I2S_NUM, buf, len * 2 * sizeof(short), &written, portMAX_DELAY);
+int audio_submit(short* buf, int len)
+{
+    audio_convert(buf, len);
+    return audio_push(buf, len);
+}
+
+int audio_fill(void)
+{
+    // Tail first: it never passes the head loaded after it
+    unsigned int tail = atomic_load_explicit(&s_tail, memory_order_acquire);
+    return atomic_load_explicit(&s_head, memory_order_acquire) - tail;
+}
+
+void audio_get_stats(audio_stats_t *stats)
+{
+    stats->fill = audio_fill();
+    stats->capacity = AUDIO_RING_FRAMES;
+    stats->underruns = atomic_load_explicit(&s_underruns, memory_order_relaxed);
+    stats->overruns = atomic_load_explicit(&s_overruns, memory_order_relaxed);
 }
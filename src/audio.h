@@ -1,6 +1,30 @@
 #pragma once
 
+#include <stdint.h>
+
+/* Stereo frames the ring between audio_submit() and the I2S feeder task
+ * holds, a power of two */
+#ifndef AUDIO_RING_FRAMES
+#define AUDIO_RING_FRAMES (2048)
+#endif
+
+typedef struct {
+    int fill; /* frames queued for I2S */
+    int capacity;
+    uint32_t underruns; /* times the feeder ran dry and played silence */
+    uint32_t overruns; /* frames dropped because the ring was full */
+} audio_stats_t;
+
 extern float audio_volume;
 
 void audio_init(int sample_rate);
-void audio_submit(short *buf, int len);
+/* Convert len stereo frames of buf in place and queue them for the feeder
+ * task without blocking. Returns the frames queued; the rest are dropped
+ * when the ring is full. */
+int audio_submit(short *buf, int len);
+/* audio_submit()'s conversion alone: len stereo frames of buf to DAC levels
+ * at audio_volume, in place, without queueing them */
+void audio_convert(short *buf, int len);
+/* Frames queued, for producers adapting how much they submit */
+int audio_fill(void);
+void audio_get_stats(audio_stats_t *stats);
@@ -0,0 +1,444 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "audio_stream.h"
+
+#define STREAM_TASK_PRIORITY (4)
+#define STREAM_TASK_STACK_SIZE (3072)
+/* Largest read; each read is a whole number of WAV blocks */
+#define STREAM_BLOCK_SIZE (2048)
+#define STREAM_BLOCKS (2)
+
+#define WAVE_FORMAT_PCM (0x0001)
+#define WAVE_FORMAT_IMA_ADPCM (0x0011)
+
+/*
+ The reader task and the decoder pass the two blocks back and forth through
+ two queues. Every seek starts a new generation: the reader moves the file
+ to the new offset before its next read, and the decoder drops blocks it
+ still receives from older generations.
+*/
+typedef struct {
+    uint8_t index;
+    uint16_t len; /* 0 at the end of the data */
+    uint32_t gen;
+} stream_block_t;
+
+struct audio_stream {
+    FILE *f;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint16_t block_align;
+    uint16_t bits;
+    uint32_t frames_per_block;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint32_t length;
+    uint32_t chunk;
+
+    // Reader task
+    uint8_t *blocks[STREAM_BLOCKS];
+    QueueHandle_t free_blocks;
+    QueueHandle_t full_blocks;
+    TaskHandle_t task;
+    SemaphoreHandle_t exited; /* given by the reader as it exits */
+    atomic_uint seek_offset;
+    atomic_uint gen;
+    atomic_bool closing;
+
+    // Decoder
+    stream_block_t block;
+    bool have_block;
+    bool ended;
+    uint32_t pos;
+    uint32_t frame;
+    uint32_t skip;
+    uint32_t loop_start;
+    uint32_t loop_end;
+
+    // IMA ADPCM state of the current WAV block
+    uint32_t block_frame;
+    uint32_t block_frames;
+    int predictor[2];
+    int step_index[2];
+};
+
+static const int16_t ima_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t ima_index[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static void stream_task(void *arg)
+{
+    audio_stream_t *s = arg;
+    uint32_t gen = ~0u;
+    uint32_t offset = 0;
+    stream_block_t block;
+
+    while (true) {
+        xQueueReceive(s->free_blocks, &block.index, portMAX_DELAY);
+        if (atomic_load(&s->closing)) {
+            break;
+        }
+
+        // The offset is stored before the generation, so it is at least as
+        // new as the generation read here
+        block.gen = atomic_load_explicit(&s->gen, memory_order_acquire);
+        if (block.gen != gen) {
+            gen = block.gen;
+            offset = atomic_load_explicit(&s->seek_offset, memory_order_relaxed);
+            fseek(s->f, s->data_offset + offset, SEEK_SET);
+        }
+
+        uint32_t len = s->data_size - offset < s->chunk ? s->data_size - offset : s->chunk;
+        block.len = fread(s->blocks[block.index], 1, len, s->f);
+        offset += block.len;
+
+        xQueueSend(s->full_blocks, &block, portMAX_DELAY);
+    }
+
+    // s may be freed as soon as this is given
+    xSemaphoreGive(s->exited);
+    vTaskDelete(NULL);
+}
+
+// Parse the RIFF chunks up to the data, leaving the format in s
+static esp_err_t stream_parse(audio_stream_t *s)
+{
+    uint8_t header[24];
+    bool have_format = false;
+
+    if (fread(header, 1, 12, s->f) != 12 || memcmp(header, "RIFF", 4) || memcmp(&header[8], "WAVE", 4)) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    while (fread(header, 1, 8, s->f) == 8) {
+        uint32_t size = get_le32(&header[4]);
+        // Chunks are padded to an even size, whatever part of them is read
+        const uint32_t pad = size & 1;
+
+        if (!memcmp(header, "fmt ", 4)) {
+            if (size < 16 || fread(header, 1, size < 20 ? size : 20, s->f) != (size < 20 ? size : 20)) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            s->format = get_le16(&header[0]);
+            s->channels = get_le16(&header[2]);
+            s->sample_rate = get_le32(&header[4]);
+            s->block_align = get_le16(&header[12]);
+            s->bits = get_le16(&header[14]);
+            s->frames_per_block = size >= 20 ? get_le16(&header[18]) : 0;
+            have_format = true;
+            size -= size < 20 ? size : 20;
+        } else if (!memcmp(header, "data", 4) && have_format) {
+            s->data_offset = ftell(s->f);
+            s->data_size = size;
+            return ESP_OK;
+        }
+
+        if (fseek(s->f, size + pad, SEEK_CUR)) {
+            break;
+        }
+    }
+
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+// Check the format and derive the track length
+static esp_err_t stream_setup(audio_stream_t *s)
+{
+    if (s->channels < 1 || s->channels > 2 || s->block_align == 0 || s->block_align > STREAM_BLOCK_SIZE) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (s->format == WAVE_FORMAT_PCM && (s->bits == 8 || s->bits == 16)) {
+        s->length = s->data_size / s->block_align;
+    } else if (s->format == WAVE_FORMAT_IMA_ADPCM && s->bits == 4 && s->block_align % (4 * s->channels) == 0) {
+        // A header sample, then eight samples per channel and word
+        uint32_t frames = (s->block_align / (4 * s->channels) - 1) * 8 + 1;
+        if (s->frames_per_block == 0 || s->frames_per_block > frames) {
+            s->frames_per_block = frames;
+        }
+        uint32_t tail = s->data_size % s->block_align;
+        s->length = s->data_size / s->block_align * s->frames_per_block;
+        if (tail >= 4 * s->channels) {
+            s->length += (tail / (4 * s->channels) - 1) * 8 + 1;
+        }
+    } else {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    s->chunk = STREAM_BLOCK_SIZE / s->block_align * s->block_align;
+    return ESP_OK;
+}
+
+esp_err_t audio_stream_open(const char *path, audio_stream_t **stream)
+{
+    audio_stream_t *s = calloc(1, sizeof(audio_stream_t));
+    if (!s) return ESP_ERR_NO_MEM;
+
+    s->f = fopen(path, "rb");
+    if (!s->f) {
+        free(s);
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = stream_parse(s);
+    if (ret == ESP_OK) {
+        ret = stream_setup(s);
+    }
+    if (ret != ESP_OK) {
+        fclose(s->f);
+        free(s);
+        return ret;
+    }
+
+    for (int i = 0; i < STREAM_BLOCKS; i++) {
+        s->blocks[i] = malloc(s->chunk);
+    }
+    s->free_blocks = xQueueCreate(STREAM_BLOCKS + 1, sizeof(uint8_t));
+    s->full_blocks = xQueueCreate(STREAM_BLOCKS, sizeof(stream_block_t));
+    s->exited = xSemaphoreCreateBinary();
+
+    if (!s->blocks[0] || !s->blocks[1] || !s->free_blocks || !s->full_blocks || !s->exited ||
+        xTaskCreate(stream_task, "audio_stream", STREAM_TASK_STACK_SIZE, s, STREAM_TASK_PRIORITY, &s->task) != pdPASS) {
+        if (s->free_blocks) vQueueDelete(s->free_blocks);
+        if (s->full_blocks) vQueueDelete(s->full_blocks);
+        if (s->exited) vSemaphoreDelete(s->exited);
+        free(s->blocks[0]);
+        free(s->blocks[1]);
+        fclose(s->f);
+        free(s);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (uint8_t i = 0; i < STREAM_BLOCKS; i++) {
+        xQueueSend(s->free_blocks, &i, 0);
+    }
+
+    *stream = s;
+    return ESP_OK;
+}
+
+void audio_stream_close(audio_stream_t *s)
+{
+    if (!s) {
+        return;
+    }
+
+    // Wake the reader wherever it is, it exits at its next block
+    uint8_t wake = 0;
+    atomic_store(&s->closing, true);
+    xQueueSend(s->free_blocks, &wake, portMAX_DELAY);
+    xSemaphoreTake(s->exited, portMAX_DELAY);
+
+    vQueueDelete(s->free_blocks);
+    vQueueDelete(s->full_blocks);
+    vSemaphoreDelete(s->exited);
+    free(s->blocks[0]);
+    free(s->blocks[1]);
+    fclose(s->f);
+    free(s);
+}
+
+int audio_stream_sample_rate(const audio_stream_t *s)
+{
+    return s->sample_rate;
+}
+
+uint32_t audio_stream_length(const audio_stream_t *s)
+{
+    return s->length;
+}
+
+static void stream_release_block(audio_stream_t *s)
+{
+    if (s->have_block) {
+        xQueueSend(s->free_blocks, &s->block.index, portMAX_DELAY);
+        s->have_block = false;
+    }
+}
+
+esp_err_t audio_stream_seek(audio_stream_t *s, uint32_t frame)
+{
+    if (frame > s->length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // ADPCM restarts at the WAV block holding frame and decodes up to it
+    uint32_t block = s->format == WAVE_FORMAT_IMA_ADPCM ? frame / s->frames_per_block : frame;
+    s->frame = s->format == WAVE_FORMAT_IMA_ADPCM ? block * s->frames_per_block : frame;
+    s->skip = frame - s->frame;
+    s->block_frame = 0;
+    s->ended = false;
+
+    stream_release_block(s);
+    atomic_store_explicit(&s->seek_offset, block * s->block_align, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->gen, 1, memory_order_release);
+
+    return ESP_OK;
+}
+
+esp_err_t audio_stream_set_loop(audio_stream_t *s, uint32_t start, uint32_t end)
+{
+    if (end > s->length || (end && start >= end)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    s->loop_start = start;
+    s->loop_end = end;
+    return ESP_OK;
+}
+
+// Make a block of the current generation current, false at the end
+static bool stream_take_block(audio_stream_t *s)
+{
+    while (!s->have_block) {
+        xQueueReceive(s->full_blocks, &s->block, portMAX_DELAY);
+        s->have_block = true;
+        s->pos = 0;
+
+        if (s->block.gen != atomic_load_explicit(&s->gen, memory_order_relaxed)) {
+            stream_release_block(s);
+        } else if (s->block.len == 0) {
+            stream_release_block(s);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int ima_decode(audio_stream_t *s, int channel, int nibble)
+{
+    int step = ima_step[s->step_index[channel]];
+    int diff = step >> 3;
+
+    if (nibble & 4) diff += step;
+    if (nibble & 2) diff += step >> 1;
+    if (nibble & 1) diff += step >> 2;
+
+    int predictor = s->predictor[channel] + (nibble & 8 ? -diff : diff);
+    s->predictor[channel] = predictor > 32767 ? 32767 : predictor < -32768 ? -32768 : predictor;
+
+    int index = s->step_index[channel] + ima_index[nibble];
+    s->step_index[channel] = index < 0 ? 0 : index > 88 ? 88 : index;
+
+    return s->predictor[channel];
+}
+
+// Decode the next frame of the current block into out, false when the
+// block holds no further frame
+static bool stream_decode(audio_stream_t *s, short *out)
+{
+    const uint8_t *data = s->blocks[s->block.index];
+    const int channels = s->channels;
+
+    if (s->format == WAVE_FORMAT_PCM) {
+        if (s->pos + s->block_align > s->block.len) {
+            return false;
+        }
+        for (int c = 0; c < channels; c++) {
+            out[c] = s->bits == 16 ? (int16_t)get_le16(&data[s->pos + c * 2]) : (data[s->pos + c] - 0x80) << 8;
+        }
+        s->pos += s->block_align;
+    } else if (s->block_frame == 0) {
+        // Header: the first sample and step index of each channel
+        if (s->pos + 4 * channels > s->block.len) {
+            return false;
+        }
+        uint32_t avail = s->block.len - s->pos;
+        if (avail > s->block_align) {
+            avail = s->block_align;
+        }
+        s->block_frames = (avail / (4 * channels) - 1) * 8 + 1;
+        if (s->block_frames > s->frames_per_block) {
+            s->block_frames = s->frames_per_block;
+        }
+
+        for (int c = 0; c < channels; c++) {
+            const uint8_t *h = &data[s->pos + c * 4];
+            s->predictor[c] = (int16_t)get_le16(h);
+            s->step_index[c] = h[2] > 88 ? 88 : h[2];
+            out[c] = s->predictor[c];
+        }
+        s->block_frame = 1;
+    } else {
+        // Words of eight samples alternate between channels, low nibble first
+        uint32_t group = (s->block_frame - 1) / 8;
+        uint32_t sample = (s->block_frame - 1) % 8;
+
+        for (int c = 0; c < channels; c++) {
+            uint8_t byte = data[s->pos + 4 * channels + (group * channels + c) * 4 + sample / 2];
+            out[c] = ima_decode(s, c, sample & 1 ? byte >> 4 : byte & 0xf);
+        }
+        s->block_frame++;
+    }
+
+    if (s->format == WAVE_FORMAT_IMA_ADPCM && s->block_frame == s->block_frames) {
+        s->pos += s->block_align;
+        s->block_frame = 0;
+    }
+
+    if (channels == 1) {
+        out[1] = out[0];
+    }
+    return true;
+}
+
+int audio_stream_read(audio_stream_t *s, short *buf, int frames)
+{
+    int n = 0;
+
+    while (n < frames && !s->ended) {
+        if (s->loop_end && s->frame >= s->loop_end) {
+            audio_stream_seek(s, s->loop_start);
+        }
+
+        if (!stream_take_block(s)) {
+            s->ended = true;
+            break;
+        }
+
+        if (!stream_decode(s, &buf[n * 2])) {
+            stream_release_block(s);
+            continue;
+        }
+
+        s->frame++;
+        if (s->skip > 0) {
+            s->skip--;
+        } else {
+            n++;
+        }
+    }
+
+    return n;
+}
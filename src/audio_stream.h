@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/* Streaming playback of WAV files (on the card mounted by sdcard_init()):
+ * 8 and 16-bit PCM and IMA ADPCM, mono or stereo. A reader task fills two
+ * blocks of the file ahead of the decoder, so memory stays at a few KB for
+ * any track length:
+ *
+ *     audio_stream_t *s;
+ *     audio_stream_open("/sd/music.wav", &s);
+ *     audio_stream_set_loop(s, 0, audio_stream_length(s));
+ *     ...
+ *     int n = audio_stream_read(s, buf, frames);
+ *     audio_submit(buf, n);
+ *
+ * The stream's rate may differ from the one given to audio_init(), pass it
+ * through a resampler then. */
+
+typedef struct audio_stream audio_stream_t;
+
+esp_err_t audio_stream_open(const char *path, audio_stream_t **stream);
+void audio_stream_close(audio_stream_t *s);
+
+int audio_stream_sample_rate(const audio_stream_t *s);
+/* Frames in the track */
+uint32_t audio_stream_length(const audio_stream_t *s);
+
+/* Continue playback at frame */
+esp_err_t audio_stream_seek(audio_stream_t *s, uint32_t frame);
+/* Jump back to frame start on reaching frame end; 0, 0 plays to the end */
+esp_err_t audio_stream_set_loop(audio_stream_t *s, uint32_t start, uint32_t end);
+
+/* Decode up to frames stereo frames into buf, mono tracks on both channels.
+ * Returns the frames decoded, fewer only at the end of the track. Waits for
+ * the reader task when it is behind, as after a seek. */
+int audio_stream_read(audio_stream_t *s, short *buf, int frames);
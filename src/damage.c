@@ -0,0 +1,85 @@
+#include <stdbool.h>
+
+#include "damage.h"
+
+
+static int rect_cost(rect_t r)
+{
+    return DAMAGE_RECT_OVERHEAD + r.width * r.height;
+}
+
+rect_t rect_union(rect_t a, rect_t b)
+{
+    short x0 = a.x < b.x ? a.x : b.x;
+    short y0 = a.y < b.y ? a.y : b.y;
+    short x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    short y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+
+    rect_t r = { x0, y0, x1 - x0, y1 - y0 };
+    return r;
+}
+
+/* Find the pair whose merge saves the most, or costs the least if none saves
+ * anything. Returns the saving, which may be negative. */
+static int best_pair(const damage_t *d, int *a, int *b)
+{
+    int best = -0x7fffffff;
+
+    for (int i = 0; i < d->count; i++) {
+        for (int j = i + 1; j < d->count; j++) {
+            int saving = rect_cost(d->rects[i]) + rect_cost(d->rects[j]) - rect_cost(rect_union(d->rects[i], d->rects[j]));
+            if (saving > best) {
+                best = saving;
+                *a = i;
+                *b = j;
+            }
+        }
+    }
+
+    return best;
+}
+
+static void merge_pair(damage_t *d, int a, int b)
+{
+    d->rects[a] = rect_union(d->rects[a], d->rects[b]);
+    d->count -= 1;
+    d->rects[b] = d->rects[d->count];
+}
+
+void damage_clear(damage_t *d)
+{
+    d->count = 0;
+}
+
+void damage_add(damage_t *d, rect_t r)
+{
+    if (r.width <= 0 || r.height <= 0) {
+        return;
+    }
+
+    for (int i = 0; i < d->count; i++) {
+        rect_t *e = &d->rects[i];
+        if (r.x >= e->x && r.y >= e->y && r.x + r.width <= e->x + e->width && r.y + r.height <= e->y + e->height) {
+            return; /* already covered */
+        }
+    }
+
+    if (d->count == DAMAGE_MAX_RECTS) {
+        int a, b;
+        best_pair(d, &a, &b);
+        merge_pair(d, a, b);
+    }
+
+    d->rects[d->count++] = r;
+}
+
+void damage_coalesce(damage_t *d)
+{
+    while (d->count > 1) {
+        int a, b;
+        if (best_pair(d, &a, &b) < 0) {
+            break;
+        }
+        merge_pair(d, a, b);
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "rect.h"
+
+#define DAMAGE_MAX_RECTS (16)
+
+/* Setting a window costs a handful of SPI transactions; this is roughly how
+ * many pixels could have been sent in the same time at 40 MHz. */
+#define DAMAGE_RECT_OVERHEAD (128)
+
+typedef struct {
+    rect_t rects[DAMAGE_MAX_RECTS];
+    short count;
+} damage_t;
+
+void damage_clear(damage_t *d);
+void damage_add(damage_t *d, rect_t r);
+void damage_coalesce(damage_t *d);
+rect_t rect_union(rect_t a, rect_t b);
@@ -1,393 +1,1495 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
-#include "esp_heap_caps.h"
-#include "esp_system.h"
-#include "esp_event.h"
-#include "driver/gpio.h"
-#include "driver/spi_master.h"
-#include "driver/ledc.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
 #include "display.h"
+#include "display_backend.h"
+#include "ili9341.h"
+#include "pixel.h"
+#include "platform.h"
 
 
-static const gpio_num_t SPI_PIN_NUM_MISO = GPIO_NUM_19;
-static const gpio_num_t SPI_PIN_NUM_MOSI = GPIO_NUM_23;
-static const gpio_num_t SPI_PIN_NUM_CLK  = GPIO_NUM_18;
+#define DISPLAY_MADCTL (MADCTL_MV | MADCTL_MY | TFT_RGB_BGR)
 
-static const gpio_num_t LCD_PIN_NUM_CS   = GPIO_NUM_5;
-static const gpio_num_t LCD_PIN_NUM_DC   = GPIO_NUM_21;
-const int LCD_SPI_CLOCK_RATE = SPI_MASTER_FREQ_40M;
+#define DISPLAY_TASK_CORE (1)
+#define DISPLAY_TASK_PRIORITY (5)
+#define DISPLAY_TASK_STACK_SIZE (2048)
+#define DISPLAY_JOB_QUEUE_LENGTH (4)
 
-#define MADCTL_MY  0x80
-#define MADCTL_MX  0x40
-#define MADCTL_MV  0x20
-#define MADCTL_ML  0x10
-#define MADCTL_MH 0x04
-#define TFT_RGB_BGR 0x08
+#define TILE_SIZE (16)
+#define TILE_MAX (DISPLAY_WIDTH / TILE_SIZE)
+#define TILE_COLS (s_width / TILE_SIZE)
+#define TILE_ROWS (s_height / TILE_SIZE)
 
-static spi_transaction_t trans[8];
-static spi_device_handle_t spi;
-static TaskHandle_t xTaskToNotify = NULL;
-static bool waitForTransactions = false;
+/*
+ A ring slot carries one pixel chunk in the DMA bounce buffer it is usually
+ copied to. seq is the backend fence of the chunk, used to tell when the slot
+ may be reused.
+*/
+typedef struct {
+    uint16_t *buf;
+    uint32_t seq;
+} display_slot_t;
 
-#define PARALLEL_LINES (5)
+static const display_backend_t *s_backend = NULL;
+static uint32_t s_fence = 0;
+static display_slot_t *s_slots = NULL;
+static int s_ring_depth;
+static int s_ring_head = 0;
+static int s_chunk_lines;
 
-static uint16_t* pbuf[2];
 gbuf_t *fb = NULL;
 
+#if DISPLAY_STATS
+// Counters of the running job, added to s_stats when it completes. Cycle
+// counts are only comparable on one core; the present task is pinned.
+static display_stats_t s_job_stats;
+static display_stats_t s_stats;
+static uint32_t s_window_us[DISPLAY_STATS_WINDOW];
+static int64_t s_window_end[DISPLAY_STATS_WINDOW];
+static uint32_t s_window_count = 0;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define STATS_START(t) uint32_t t = xthal_get_ccount()
+#define STATS_ADD(field, n) (s_job_stats.field += (n))
+#define STATS_SINCE(field, t) STATS_ADD(field, xthal_get_ccount() - (t))
+#else
+#define STATS_START(t)
+#define STATS_ADD(field, n) ((void)0)
+#define STATS_SINCE(field, t) ((void)0)
+#endif
+
 /*
  The ILI9341 needs a bunch of command/argument values to be initialized. They are stored in this struct.
+ delay is the time the panel needs after the command before the next one, in ms.
 */
 typedef struct {
     uint8_t cmd;
-    uint8_t data[128];
-    uint8_t databytes; //No of data in data; bit 7 = delay after set; 0xFF = end of cmds.
+    uint8_t data[16];
+    uint8_t databytes; //No of data in data; 0xFF = end of cmds.
+    uint8_t delay;
 } ili_init_cmd_t;
 
-#define TFT_CMD_SWRESET	0x01
-#define TFT_CMD_SLEEP 0x10
-#define TFT_CMD_DISPLAY_OFF 0x28
+// Datasheet minimums. Commands may follow a reset or sleep in/out after 5 ms,
+// but a reset during sleep out (a warm boot) needs 120 ms before the next
+// sleep out.
+#define TFT_DELAY_SWRESET 120
+#define TFT_DELAY_SLEEP 5
 
 DRAM_ATTR static const ili_init_cmd_t ili_sleep_cmds[] = {
-    {TFT_CMD_SWRESET, {0}, 0x80},
-    {TFT_CMD_DISPLAY_OFF, {0}, 0x80},
-    {TFT_CMD_SLEEP, {0}, 0x80},
-    {0, {0}, 0xff}
+    {TFT_CMD_SWRESET, {0}, 0, TFT_DELAY_SLEEP},
+    {TFT_CMD_DISPLAY_OFF, {0}, 0, 0},
+    {TFT_CMD_SLEEP, {0}, 0, TFT_DELAY_SLEEP},
+    {0, {0}, 0xff, 0}
 };
 
 // 2.4" LCD
 DRAM_ATTR static const ili_init_cmd_t ili_init_cmds[] = {
     // VCI=2.8V
     //************* Start Initial Sequence **********//
-    {TFT_CMD_SWRESET, {0}, 0x80},
-    {0xCF, {0x00, 0xc3, 0x30}, 3},
-    {0xED, {0x64, 0x03, 0x12, 0x81}, 4},
-    {0xE8, {0x85, 0x00, 0x78}, 3},
-    {0xCB, {0x39, 0x2c, 0x00, 0x34, 0x02}, 5},
-    {0xF7, {0x20}, 1},
-    {0xEA, {0x00, 0x00}, 2},
-    {0xC0, {0x1B}, 1},    //Power control   //VRH[5:0]
-    {0xC1, {0x12}, 1},    //Power control   //SAP[2:0];BT[3:0]
-    {0xC5, {0x32, 0x3C}, 2},    //VCM control
-    {0xC7, {0x91}, 1},    //VCM control2
-    {0x36, {(MADCTL_MV | MADCTL_MY | TFT_RGB_BGR)}, 1},    // Memory Access Control
-    {0x3A, {0x55}, 1},
-    {0xB1, {0x00, 0x1B}, 2},  // Frame Rate Control (1B=70, 1F=61, 10=119)
-    {0xB6, {0x0A, 0xA2}, 2},    // Display Function Control
-    {0xF6, {0x01, 0x30}, 2},
-    {0xF2, {0x00}, 1},    // 3Gamma Function Disable
-    {0x26, {0x01}, 1},     //Gamma curve selected
+    {TFT_CMD_SWRESET, {0}, 0, TFT_DELAY_SWRESET},
+    {0xCF, {0x00, 0xc3, 0x30}, 3, 0},
+    {0xED, {0x64, 0x03, 0x12, 0x81}, 4, 0},
+    {0xE8, {0x85, 0x00, 0x78}, 3, 0},
+    {0xCB, {0x39, 0x2c, 0x00, 0x34, 0x02}, 5, 0},
+    {0xF7, {0x20}, 1, 0},
+    {0xEA, {0x00, 0x00}, 2, 0},
+    {0xC0, {0x1B}, 1, 0},    //Power control   //VRH[5:0]
+    {0xC1, {0x12}, 1, 0},    //Power control   //SAP[2:0];BT[3:0]
+    {0xC5, {0x32, 0x3C}, 2, 0},    //VCM control
+    {0xC7, {0x91}, 1, 0},    //VCM control2
+    {TFT_CMD_MADCTL, {DISPLAY_MADCTL}, 1, 0},    // Memory Access Control
+    {0x3A, {0x55}, 1, 0},
+    {0xB1, {0x00, 0x1B}, 2, 0},  // Frame Rate Control (1B=70, 1F=61, 10=119)
+    {0xB6, {0x0A, 0xA2}, 2, 0},    // Display Function Control
+    {0xF6, {0x01, 0x30}, 2, 0},
+    {0xF2, {0x00}, 1, 0},    // 3Gamma Function Disable
+    {0x26, {0x01}, 1, 0},     //Gamma curve selected
 
     //Set Gamma
-    {0xE0, {0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07, 0x10, 0x03, 0x0E, 0x09, 0x00}, 15},
-    {0XE1, {0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08, 0x0F, 0x0C, 0x31, 0x36, 0x0F}, 15},
+    {0xE0, {0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07, 0x10, 0x03, 0x0E, 0x09, 0x00}, 15, 0},
+    {0XE1, {0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08, 0x0F, 0x0C, 0x31, 0x36, 0x0F}, 15, 0},
 
-    {0x11, {0}, 0x80},    //Exit Sleep
-    {0x29, {0}, 0x80},    //Display on
+    {TFT_CMD_SLEEP_OUT, {0}, 0, TFT_DELAY_SLEEP},    //Exit Sleep
+    {TFT_CMD_DISPLAY_ON, {0}, 0, 0},    //Display on
 
-    {0, {0}, 0xff}
+    {0, {0}, 0xff, 0}
 };
 
-// Send a command to the ILI9341. Uses spi_device_transmit, which waits until
-// the transfer is complete.
-static void ili_cmd(spi_device_handle_t spi, const uint8_t cmd)
+typedef enum {
+    DISPLAY_JOB_UPDATE,
+    DISPLAY_JOB_UPDATE_RECT,
+    DISPLAY_JOB_UPDATE_DAMAGE,
+    DISPLAY_JOB_UPDATE_SCALED,
+    DISPLAY_JOB_CLEAR,
+    DISPLAY_JOB_SCROLL,
+    DISPLAY_JOB_COMMANDS,
+    DISPLAY_JOB_FRAME,
+    DISPLAY_JOB_ORIENTATION,
+} display_job_type_t;
+
+/*
+ Hardware scroll area along the x axis, which is the panel's scan direction
+ in this orientation. Screen position start + i shows panel memory column
+ start + (i + offset) % length. An empty area means no scrolling.
+*/
+typedef struct {
+    short start;
+    short length;
+    short offset;
+} display_scroll_t;
+
+typedef struct {
+    display_job_type_t type;
+    display_present_mode_t mode;
+    display_fence_t fence;
+    const gbuf_t *src;
+    rect_t rect;
+    damage_t damage;
+    display_scale_t scale;
+    bool letterbox;
+    display_scroll_t scroll;
+    uint16_t color;
+    const ili_init_cmd_t *cmds;
+    uint8_t madctl;
+} display_job_t;
+
+// Logical screen size in the current orientation. Only changed while no
+// present is in flight.
+static short s_width = DISPLAY_WIDTH;
+static short s_height = DISPLAY_HEIGHT;
+
+// Memory access control the panel was last programmed with
+static uint8_t s_madctl = DISPLAY_MADCTL;
+
+/*
+ Triple-buffered frame queue. The producer owns the back buffer and the
+ present task the front one; the latest submitted frame waits in the middle.
+ Both sides hand buffers over by swapping their index with the middle one,
+ FRAME_FRESH marks a middle frame that has not been presented yet.
+*/
+#define FRAME_FRESH (0x80)
+
+static gbuf_t *s_frames[DISPLAY_FRAME_COUNT];
+static int s_frame_back = 0;
+static int s_frame_front = 2;
+static atomic_int s_frame_middle = 1;
+
+static TaskHandle_t s_present_task = NULL;
+static QueueHandle_t s_job_queue = NULL;
+static SemaphoreHandle_t s_submit_lock = NULL;
+static display_fence_t s_submitted = 0;
+static volatile display_fence_t s_completed = 0;
+
+/*
+ Each task blocked in display_wait() owns one bit of s_waiter_events, set by
+ the present task whenever a job completes. Waiters re-check their fence on
+ every wake, so bits left over from an earlier owner are harmless. The mask
+ of owned bits and s_completed only change together under s_waiter_lock, so
+ a waiter that registered before its fence was done is always woken.
+*/
+#define DISPLAY_WAITERS (8)
+static EventGroupHandle_t s_waiter_events = NULL;
+static EventBits_t s_waiter_mask = 0;
+static portMUX_TYPE s_waiter_lock = portMUX_INITIALIZER_UNLOCKED;
+static damage_t s_fb_damage = { .count = 0 };
+static display_present_mode_t s_present_mode = DISPLAY_PRESENT_FULL;
+
+// Scroll state as requested by callers, and as applied by the display task
+static display_scroll_t s_scroll_req = { 0, 0, 0 };
+static display_scroll_t s_scroll = { 0, 0, 0 };
+
+/*
+ Source to screen mapping for scaled presents, rebuilt only when the source
+ size, scaling mode or orientation changes. For each screen column/row of dst
+ the map holds the source column/row and, for filtered scaling, the weight
+ (0-31) of the next one. The line buffers hold line_width pixels.
+*/
+static struct {
+    uint16_t src_width;
+    uint16_t src_height;
+    display_scale_t scale;
+    bool letterbox;
+    rect_t dst;
+    uint16_t *lines[2];
+    uint16_t line_width;
+    int line_y[2];
+    uint16_t col_map[DISPLAY_WIDTH];
+    uint8_t col_frac[DISPLAY_WIDTH];
+    uint16_t row_map[DISPLAY_WIDTH];
+    uint8_t row_frac[DISPLAY_WIDTH];
+} s_scale_map = { .src_width = 0, .lines = { NULL, NULL }, .line_width = 0 };
+
+// Set when something other than a scaled present may have drawn over the
+// letterbox borders
+static bool s_scale_borders_dirty = true;
+
+// Per-tile hashes of the last frame sent in tile diff mode
+static uint32_t s_tile_hash[TILE_MAX][TILE_MAX];
+static bool s_tile_hash_valid = false;
+static uint32_t s_tile_palette_hash = 0;
+
+// Per-line hashes of the last frame sent in line diff mode
+static uint32_t s_line_hash[DISPLAY_WIDTH];
+static bool s_line_hash_valid = false;
+static uint32_t s_line_palette_hash = 0;
+
+// Next field to send in interlaced mode
+static int s_field = 0;
+
+// Pixel bytes sent by the current job, and by the last display_update()
+static uint32_t s_bytes_sent = 0;
+static volatile uint32_t s_frame_sent = 0;
+
+// Dither 24-bit sources down to RGB565
+static bool s_dither = false;
+
+// Palette of the indexed source being presented, in panel byte order
+static uint16_t s_palette[GBUF_PALETTE_SIZE] __attribute__((aligned(4)));
+
+// Backend calls, timed as stalls: they block once the transport is full
+static void backend_wait(uint32_t fence)
 {
-    esp_err_t ret;
-    spi_transaction_t t;
-    memset(&t, 0, sizeof(t));   // Zero out the transaction
-    t.length = 8;               // Command is 8 bits
-    t.tx_buffer = &cmd;         // The data is the cmd itself
-    t.user = (void*)0;          // D/C needs to be set to 0
-    ret = spi_device_transmit(spi, &t); // Transmit!
-    assert(ret == ESP_OK);      //Should have had no issues.
+    STATS_START(start);
+    s_backend->wait(fence);
+    STATS_SINCE(stall_cycles, start);
 }
 
-// Send data to the ILI9341. Uses spi_device_transmit, which waits until the
-// transfer is complete.
-static void ili_data(spi_device_handle_t spi, const uint8_t *data, int len)
+static void ring_flush(void)
 {
-    esp_err_t ret;
-    spi_transaction_t t;
-    if (len == 0) return;       // No need to send anything
-    memset(&t, 0, sizeof(t));   // Zero out the transaction
-    t.length = len * 8;         // Len is in bytes, transaction length is in bits.
-    t.tx_buffer = data;         // Data
-    t.user = (void*)1;          // D/C needs to be set to 1
-    ret = spi_device_transmit(spi, &t); // Transmit!
-    assert(ret == ESP_OK);      // Should have had no issues.
+    backend_wait(s_fence);
 }
 
-// This function is called (in irq context!) just before a transmission starts.
-// It will set the D/C line to the value indicated in the user field.
-static void ili_spi_pre_transfer_callback(spi_transaction_t *t)
+static void send_reset_drawing(int x, int y, int width, int height)
 {
-    int dc = (int)t->user;
-    gpio_set_level(LCD_PIN_NUM_DC, dc);
+    STATS_START(start);
+    s_fence = s_backend->window(x, y, width, height);
+    STATS_SINCE(stall_cycles, start);
 }
 
-static void ili_spi_post_transfer_callback(spi_transaction_t *t)
+// Get the next ring slot, waiting for its previous chunk to finish if needed.
+static display_slot_t *ring_acquire(void)
 {
-    if(xTaskToNotify && t == &trans[7]) {
-        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    display_slot_t *slot = &s_slots[s_ring_head];
+    backend_wait(slot->seq);
+    s_ring_head = (s_ring_head + 1) % s_ring_depth;
+    return slot;
+}
+
+static void ring_send(display_slot_t *slot, const uint16_t *pixels, int width, int height)
+{
+    s_bytes_sent += width * height * 2;
+    STATS_ADD(bytes, width * height * 2);
 
-        /* Notify the task that the transmission is complete. */
-        vTaskNotifyGiveFromISR(xTaskToNotify, &xHigherPriorityTaskWoken);
+    STATS_START(start);
+    s_fence = s_backend->pixels(pixels, width * height);
+    STATS_SINCE(stall_cycles, start);
+    slot->seq = s_fence;
+}
+
+// Queue a command with up to 16 bytes of arguments.
+static void send_command(uint8_t cmd, const uint8_t *data, int len)
+{
+    STATS_ADD(bytes, 1 + len);
 
-        if (xHigherPriorityTaskWoken) {
-            portYIELD_FROM_ISR();
+    STATS_START(start);
+    s_fence = s_backend->command(cmd, data, len);
+    STATS_SINCE(stall_cycles, start);
+}
+
+// Send a command table. Runs of commands without a delay are queued
+// back-to-back; the queue is flushed before each delay.
+static void send_commands(const ili_init_cmd_t *cmds)
+{
+    for (; cmds->databytes != 0xff; cmds++) {
+        send_command(cmds->cmd, cmds->data, cmds->databytes);
+
+        if (cmds->delay > 0) {
+            ring_flush();
+            // One extra tick, the first may end right away
+            vTaskDelay((cmds->delay + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS + 1);
         }
     }
 }
 
-// Initialize the display
-static void ili_init()
+// Latch the palette of an indexed source in panel byte order, so a present
+// sees one consistent palette even if the caller changes it meanwhile.
+static void prepare_source(const gbuf_t *src)
 {
-    int cmd=0;
-    // Initialize non-SPI GPIOs
-    gpio_set_direction(LCD_PIN_NUM_DC, GPIO_MODE_OUTPUT);
+    if (src->bytes_per_pixel != 1) {
+        return;
+    }
 
-    // Send all the commands
-    while (ili_init_cmds[cmd].databytes!=0xff) {
-        ili_cmd(spi, ili_init_cmds[cmd].cmd);
-        ili_data(spi, ili_init_cmds[cmd].data, ili_init_cmds[cmd].databytes&0x7F);
-        if (ili_init_cmds[cmd].databytes&0x80) {
-            vTaskDelay(100 / portTICK_RATE_MS);
+    if (src->endian == BIG_ENDIAN) {
+        memcpy(s_palette, src->palette, sizeof(s_palette));
+    } else {
+        for (int i = 0; i < GBUF_PALETTE_SIZE; i++) {
+            s_palette[i] = pixel_bswap16(src->palette[i]);
         }
-        cmd++;
     }
 }
 
-static void send_reset_drawing(int x, int y, int width, int height)
+// Convert width pixels of src starting at (x, y) into panel-order RGB565.
+static void fetch_line(uint16_t *dst, const gbuf_t *src, int x, int y, int width)
 {
-  trans[0].tx_data[0] = 0x2A;       // Column Address Set
-  trans[1].tx_data[0] = x >> 8;     // Start Col High
-  trans[1].tx_data[1] = x & 0xff;   // Start Col Low
-  trans[1].tx_data[2] = (x + width - 1) >> 8;       // End Col High
-  trans[1].tx_data[3] = (x + width - 1) & 0xff;     // End Col Low
-  trans[2].tx_data[0] = 0x2B;       // Page address set
-  trans[3].tx_data[0] = y >> 8;     // Start page high
-  trans[3].tx_data[1] = y & 0xff;   // Start page low
-  trans[3].tx_data[2] = (y + height - 1) >> 8;      // End page high
-  trans[3].tx_data[3] = (y + height - 1) & 0xff;    // End page low
-  trans[4].tx_data[0] = 0x2C;       // Memory write
+    const uint8_t *p = src->data + y * src->stride + x * src->bytes_per_pixel;
+
+    switch (src->bytes_per_pixel) {
+        case 1:
+            pixel_expand_indexed(dst, p, s_palette, width);
+            break;
+
+        case 2:
+            if (src->endian == BIG_ENDIAN) {
+                memcpy(dst, p, width * sizeof(uint16_t));
+            } else {
+                pixel_swap16(dst, (const uint16_t *)p, width);
+            }
+            break;
 
-  // Queue all transactions.
-  for (int x = 0; x < 5; x++) {
-      esp_err_t ret = spi_device_queue_trans(spi, &trans[x], 1000 / portTICK_RATE_MS);
-      assert(ret == ESP_OK);
-  }
+        case 3:
+            if (s_dither) {
+                pixel_rgb888_to_rgb565_dither(dst, p, width, x, y);
+            } else {
+                pixel_rgb888_to_rgb565(dst, p, width);
+            }
+            break;
+
+        case 4:
+            if (s_dither) {
+                pixel_rgba8888_to_rgb565_dither(dst, p, width, x, y);
+            } else {
+                pixel_rgba8888_to_rgb565(dst, p, width);
+            }
+            break;
+
+        default:
+            assert(0 && "unsupported pixel format");
+    }
 }
 
-static void send_continue_wait()
+// A buffer can be handed to the SPI DMA as-is if it already holds packed
+// panel-order pixels in DMA-capable, word-aligned memory. PSRAM buffers are
+// not.
+static bool can_send_direct(const gbuf_t *src)
 {
-  if (waitForTransactions) {
-    ulTaskNotifyTake(pdTRUE, 1000 / portTICK_RATE_MS);
+    return src->bytes_per_pixel == 2 && src->endian == BIG_ENDIAN && gbuf_packed(src) &&
+           esp_ptr_dma_capable(src->data) && ((uintptr_t)src->data & 3) == 0 && (src->stride & 3) == 0;
+}
 
-    // Drain SPI queue
-    esp_err_t err = ESP_OK;
-    while(err == ESP_OK) {
-        spi_transaction_t* trans_desc;
-        err = spi_device_get_trans_result(spi, &trans_desc, 0);
+// Split r into parts that are contiguous in panel memory under the current
+// scroll offset, giving the memory column of each part in addr. Returns the
+// number of parts.
+static int scroll_map(rect_t r, rect_t *parts, short *addr)
+{
+    const display_scroll_t *sc = &s_scroll;
+    short cuts[5];
+    int ncuts = 0;
+
+    cuts[ncuts++] = r.x;
+    if (sc->length > 0) {
+        short bounds[3] = { sc->start, sc->start + sc->length - sc->offset, sc->start + sc->length };
+        for (int i = 0; i < 3; i++) {
+            if (bounds[i] > cuts[ncuts - 1] && bounds[i] < r.x + r.width) {
+                cuts[ncuts++] = bounds[i];
+            }
+        }
+    }
+    cuts[ncuts] = r.x + r.width;
+
+    for (int i = 0; i < ncuts; i++) {
+        short x = cuts[i];
+
+        parts[i] = r;
+        parts[i].x = x;
+        parts[i].width = cuts[i + 1] - x;
+
+        addr[i] = x;
+        if (sc->length > 0 && x >= sc->start && x < sc->start + sc->length) {
+            addr[i] = sc->start + (x - sc->start + sc->offset) % sc->length;
+        }
+    }
+
+    return ncuts;
+}
+
+static void send_fill(rect_t r, uint16_t color)
+{
+    send_reset_drawing(r.x, r.y, r.width, r.height);
+
+    uint16_t pixel = (color << 8) | (color >> 8);
+
+    // Each chunk fills its own slot: with no flush between rects a shared
+    // buffer could be rewritten by a later send while still queued
+    for (short dy = 0; dy < r.height; dy += s_chunk_lines) {
+        display_slot_t *slot = ring_acquire();
+        short numLines = r.height - dy;
+        numLines = numLines < s_chunk_lines ? numLines : s_chunk_lines;
+        int count = r.width * numLines;
+        STATS_START(start);
+        for (int i = 0; i < count; i++) {
+            slot->buf[i] = pixel;
+        }
+        STATS_SINCE(copy_cycles, start);
+        ring_send(slot, slot->buf, r.width, numLines);
+    }
+}
+
+// Send rect r of src to the panel memory window at (dst_x, r.y).
+static void send_rect(const gbuf_t *src, rect_t r, short dst_x)
+{
+    send_reset_drawing(dst_x, r.y, r.width, r.height);
+
+    if (r.width == src->width && can_send_direct(src)) {
+        // Full-width rows are contiguous in src, send them without a copy
+        for (short dy = 0; dy < r.height; dy += s_chunk_lines) {
+            display_slot_t *slot = ring_acquire();
+            short numLines = r.height - dy;
+            numLines = numLines < s_chunk_lines ? numLines : s_chunk_lines;
+            ring_send(slot, (const uint16_t *)(src->data + src->stride * (r.y + dy)), r.width, numLines);
+        }
+    } else {
+        for (short dy = 0; dy < r.height; dy += s_chunk_lines) {
+            display_slot_t *slot = ring_acquire();
+            short numLines = r.height - dy;
+            numLines = numLines < s_chunk_lines ? numLines : s_chunk_lines;
+            STATS_START(start);
+            for (short line = 0; line < numLines; line++) {
+                fetch_line(slot->buf + r.width * line, src, r.x, r.y + dy + line, r.width);
+            }
+            STATS_SINCE(copy_cycles, start);
+            ring_send(slot, slot->buf, r.width, numLines);
+        }
     }
+}
 
-    waitForTransactions = false;
-  }
+static void present_fill(rect_t r, uint16_t color)
+{
+    rect_t parts[4];
+    short addr[4];
+    int count = scroll_map(r, parts, addr);
+
+    for (int i = 0; i < count; i++) {
+        parts[i].x = addr[i];
+        send_fill(parts[i], color);
+    }
 }
 
-static void send_continue_line(uint16_t *line, int width, int height)
+static void present_rect(const gbuf_t *src, rect_t r)
 {
-  send_continue_wait();
+    rect_t parts[4];
+    short addr[4];
+    int count = scroll_map(r, parts, addr);
 
-  trans[6].tx_data[0] = 0x3C;   //memory write continue
-  trans[6].length = 8;          //Data length, in bits
-  trans[6].flags = SPI_TRANS_USE_TXDATA;
+    for (int i = 0; i < count; i++) {
+        send_rect(src, parts[i], addr[i]);
+    }
+}
 
-  trans[7].tx_buffer = line;    //finally send the line data
-  trans[7].length = width * height * 16; //Data length, in bits
-  trans[7].rxlength = 0;
-  trans[7].flags = 0;
-  
-  // Queue transactions.
-  for (int x = 6; x < 8; x++) {
-      esp_err_t ret = spi_device_queue_trans(spi, &trans[x], 1000 / portTICK_RATE_MS);
-      assert(ret == ESP_OK);
-  }
+static void present_frame(const gbuf_t *src)
+{
+    rect_t r = { 0, 0, s_width, s_height };
+    present_rect(src, r);
+}
 
-  waitForTransactions = true;
+static uint32_t hash_words(uint32_t h, const uint32_t *p, int count)
+{
+    while (count--) {
+        h = (h ^ *p++) * 16777619u;
+    }
+    return h;
 }
 
-static uint16_t *get_pbuf(void) {
-    static uint16_t *current = NULL;
-    if (current == NULL) {
-        current = pbuf[0];
+// Hash every tile of one tile row of src into hash, four bytes at a time.
+static void hash_tile_row(const gbuf_t *src, int ty, uint32_t *hash)
+{
+    const int words = TILE_SIZE * src->bytes_per_pixel / 4;
+
+    for (int tx = 0; tx < TILE_COLS; tx++) {
+        hash[tx] = 2166136261u;
     }
-    uint16_t *result = current;
 
-    if (current == pbuf[0]) {
-        current = pbuf[1];
-    } else {
-        current = pbuf[0];
+    for (int line = 0; line < TILE_SIZE; line++) {
+        const uint32_t *p = (const uint32_t *)(src->data + (ty * TILE_SIZE + line) * src->stride);
+        for (int tx = 0; tx < TILE_COLS; tx++) {
+            hash[tx] = hash_words(hash[tx], p, words);
+            p += words;
+        }
     }
-    return result;
 }
 
-void display_init(void)
+// Check the latched palette of an indexed src against the hash of the last
+// one seen by a diff mode.
+static bool palette_changed(const gbuf_t *src, uint32_t *last_hash)
+{
+    if (src->bytes_per_pixel != 1) {
+        return false;
+    }
+
+    uint32_t h = hash_words(2166136261u, (const uint32_t *)s_palette, sizeof(s_palette) / 4);
+    if (h == *last_hash) {
+        return false;
+    }
+
+    *last_hash = h;
+    return true;
+}
+
+// Send only the tiles that changed since the last diffed frame. Changed tiles
+// are grouped into spans per tile row, and the spans are coalesced with the
+// damage cost model before sending.
+static void present_frame_diff(const gbuf_t *src)
 {
-    fb = gbuf_new(DISPLAY_WIDTH, DISPLAY_HEIGHT, 2, BIG_ENDIAN);
-    memset(fb->data, 0, DISPLAY_WIDTH * DISPLAY_HEIGHT * 2);
+    damage_t damage;
+    damage_clear(&damage);
+
+    // A palette change affects every tile
+    if (palette_changed(src, &s_tile_palette_hash)) {
+        s_tile_hash_valid = false;
+    }
 
-    pbuf[0] = heap_caps_malloc(320 * PARALLEL_LINES * sizeof(uint16_t), MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
-    if (!pbuf[0]) abort();
+    for (int ty = 0; ty < TILE_ROWS; ty++) {
+        uint32_t hash[TILE_MAX];
+        hash_tile_row(src, ty, hash);
+
+        int start = -1;
+        for (int tx = 0; tx <= TILE_COLS; tx++) {
+            bool changed = tx < TILE_COLS && (!s_tile_hash_valid || hash[tx] != s_tile_hash[ty][tx]);
+            if (changed && start < 0) {
+                start = tx;
+            } else if (!changed && start >= 0) {
+                rect_t r = { start * TILE_SIZE, ty * TILE_SIZE, (tx - start) * TILE_SIZE, TILE_SIZE };
+                damage_add(&damage, r);
+                start = -1;
+            }
+        }
+
+        memcpy(s_tile_hash[ty], hash, sizeof(hash));
+    }
+    s_tile_hash_valid = true;
 
-    pbuf[1] = heap_caps_malloc(320 * PARALLEL_LINES * sizeof(uint16_t), MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
-    if (!pbuf[1]) abort();
+    damage_coalesce(&damage);
+    for (int i = 0; i < damage.count; i++) {
+        present_rect(src, damage.rects[i]);
+    }
+}
+
+// Send runs of lines that changed since the last diffed frame.
+static void present_frame_line_diff(const gbuf_t *src)
+{
+    const int words = s_width * src->bytes_per_pixel / 4;
+    int start = -1;
+
+    if (palette_changed(src, &s_line_palette_hash)) {
+        s_line_hash_valid = false;
+    }
+
+    for (int y = 0; y <= s_height; y++) {
+        bool changed = false;
+        if (y < s_height) {
+            const uint32_t *p = (const uint32_t *)(src->data + y * src->stride);
+            uint32_t h = hash_words(2166136261u, p, words);
+            changed = !s_line_hash_valid || h != s_line_hash[y];
+            s_line_hash[y] = h;
+        }
+
+        if (changed && start < 0) {
+            start = y;
+        } else if (!changed && start >= 0) {
+            rect_t r = { 0, start, s_width, y - start };
+            present_rect(src, r);
+            start = -1;
+        }
+    }
+
+    s_line_hash_valid = true;
+}
 
-	// Initialize transactions
-    for (int x = 0; x < 8; x++) {
-        memset(&trans[x], 0, sizeof(spi_transaction_t));
-        if ((x & 1) == 0) {
-            // Even transfers are commands
-            trans[x].length = 8;
-            trans[x].user = (void*)0;
+// Send every other line, alternating between even and odd lines each frame.
+// Every line needs its own window, but the ring keeps them back-to-back.
+static void present_frame_interlaced(const gbuf_t *src)
+{
+    for (int y = s_field; y < s_height; y += 2) {
+        rect_t r = { 0, y, s_width, 1 };
+        present_rect(src, r);
+    }
+
+    s_field ^= 1;
+}
+
+static void build_axis_map(uint16_t *map, uint8_t *frac, int dst_size, int src_size, bool filtered)
+{
+    for (int i = 0; i < dst_size; i++) {
+        // Sample at pixel centers, in 16.16 fixed point
+        int32_t pos = (int32_t)(((int64_t)(2 * i + 1) * src_size << 16) / (2 * dst_size));
+        if (filtered) {
+            pos -= 1 << 15;
+            if (pos < 0) {
+                pos = 0;
+            }
+        }
+
+        int index = pos >> 16;
+        int weight = filtered ? (pos >> 11) & 31 : 0;
+        if (index >= src_size - 1) {
+            index = src_size - 1;
+            weight = 0;
+        }
+
+        map[i] = index;
+        frac[i] = weight;
+    }
+}
+
+// Rebuild the scale map for src if needed. Returns true if it changed, in
+// which case the letterbox borders need to be cleared.
+static bool update_scale_map(const gbuf_t *src, display_scale_t scale, bool letterbox)
+{
+    if (s_scale_map.src_width == src->width && s_scale_map.src_height == src->height &&
+        s_scale_map.scale == scale && s_scale_map.letterbox == letterbox) {
+        return false;
+    }
+
+    int w = s_width;
+    int h = s_height;
+
+    int factor = s_width / src->width < s_height / src->height ?
+                 s_width / src->width : s_height / src->height;
+    if (scale == DISPLAY_SCALE_INTEGER && factor > 0) {
+        w = src->width * factor;
+        h = src->height * factor;
+    } else if (scale == DISPLAY_SCALE_INTEGER || letterbox) {
+        // Largest size with the source aspect ratio
+        if (s_width * src->height <= s_height * src->width) {
+            h = src->height * s_width / src->width;
         } else {
-            // Odd transfers are data
-            trans[x].length = 8 * 4;
-            trans[x].user = (void*)1;
+            w = src->width * s_height / src->height;
         }
-        trans[x].flags = SPI_TRANS_USE_TXDATA;
     }
 
-    // Initialize SPI
-    esp_err_t ret;
-    spi_bus_config_t buscfg;
+    rect_t dst = { (s_width - w) / 2, (s_height - h) / 2, w, h };
+    bool filtered = scale == DISPLAY_SCALE_FILTERED;
 
-    memset(&buscfg, 0, sizeof(buscfg));
+    if (s_scale_map.line_width != src->width) {
+        for (int i = 0; i < 2; i++) {
+            free(s_scale_map.lines[i]);
+            s_scale_map.lines[i] = malloc(src->width * sizeof(uint16_t));
+            if (!s_scale_map.lines[i]) abort();
+        }
+        s_scale_map.line_width = src->width;
+    }
 
-    buscfg.miso_io_num = SPI_PIN_NUM_MISO;
-    buscfg.mosi_io_num = SPI_PIN_NUM_MOSI;
-    buscfg.sclk_io_num = SPI_PIN_NUM_CLK;
-    buscfg.quadwp_io_num = -1;
-    buscfg.quadhd_io_num = -1;
+    build_axis_map(s_scale_map.col_map, s_scale_map.col_frac, w, src->width, filtered);
+    build_axis_map(s_scale_map.row_map, s_scale_map.row_frac, h, src->height, filtered);
 
-    spi_device_interface_config_t devcfg;
+    s_scale_map.src_width = src->width;
+    s_scale_map.src_height = src->height;
+    s_scale_map.scale = scale;
+    s_scale_map.letterbox = letterbox;
+    s_scale_map.dst = dst;
 
-    memset(&devcfg, 0, sizeof(devcfg));
+    return true;
+}
 
-    devcfg.clock_speed_hz = LCD_SPI_CLOCK_RATE;
-    devcfg.mode = 0;                                // SPI mode 0
-    devcfg.spics_io_num = LCD_PIN_NUM_CS;           // CS pin
-    devcfg.queue_size = 7;                          // We want to be able to queue 7 transactions at a time
-    devcfg.pre_cb = ili_spi_pre_transfer_callback;  // Specify pre-transfer callback to handle D/C line
-    devcfg.post_cb = ili_spi_post_transfer_callback;
-    devcfg.flags = SPI_DEVICE_NO_DUMMY;
+// Get source row y in panel-order RGB565, converting it into one of the two
+// line buffers unless src can be read as-is. The last two converted rows are
+// kept, as upscaling reads each one several times.
+static const uint16_t *scale_get_line(const gbuf_t *src, int y, int which)
+{
+    if (src->bytes_per_pixel == 2 && src->endian == BIG_ENDIAN) {
+        return (const uint16_t *)(src->data + y * src->stride);
+    }
 
-    ret = spi_bus_initialize(HSPI_HOST, &buscfg, 1);
-    assert(ret == ESP_OK);
+    for (int i = 0; i < 2; i++) {
+        if (s_scale_map.line_y[i] == y) {
+            return s_scale_map.lines[i];
+        }
+    }
+
+    fetch_line(s_scale_map.lines[which], src, 0, y, src->width);
+    s_scale_map.line_y[which] = y;
+    return s_scale_map.lines[which];
+}
 
-    ret = spi_bus_add_device(HSPI_HOST, &devcfg, &spi);
-    assert(ret == ESP_OK);
+static void scale_line_nearest(uint16_t *dst, const uint16_t *row, int width)
+{
+    const uint16_t *map = s_scale_map.col_map;
 
-    ili_init();
+    for (int x = 0; x < width; x++) {
+        dst[x] = row[map[x]];
+    }
 }
 
-void display_drain(void)
+static void scale_line_filtered(uint16_t *dst, const uint16_t *row0, const uint16_t *row1, int row_weight, int width)
 {
-    // Drain SPI queue
-    xTaskToNotify = 0;
+    const uint16_t *map = s_scale_map.col_map;
+    const uint8_t *frac = s_scale_map.col_frac;
+
+    for (int x = 0; x < width; x++) {
+        int sx = map[x];
+        int sx1 = frac[x] ? sx + 1 : sx;
 
-    esp_err_t err = ESP_OK;
+        uint16_t p00 = pixel_bswap16(row0[sx]), p01 = pixel_bswap16(row0[sx1]);
+        uint16_t p10 = pixel_bswap16(row1[sx]), p11 = pixel_bswap16(row1[sx1]);
 
-    while(err == ESP_OK) {
-        spi_transaction_t* trans_desc;
-        err = spi_device_get_trans_result(spi, &trans_desc, 0);
+        uint32_t top = pixel_lerp_expanded(pixel_expand565(p00), pixel_expand565(p01), frac[x]);
+        uint32_t bottom = pixel_lerp_expanded(pixel_expand565(p10), pixel_expand565(p11), frac[x]);
+        dst[x] = pixel_bswap16(pixel_pack565(pixel_lerp_expanded(top, bottom, row_weight)));
     }
 }
 
-void display_poweroff()
+// Scale src onto the screen while filling each chunk, without an intermediate
+// full-screen buffer.
+static void present_scaled(const gbuf_t *src, display_scale_t scale, bool letterbox)
 {
-    display_drain();
+    if (update_scale_map(src, scale, letterbox) || s_scale_borders_dirty) {
+        // Clear the borders around the destination
+        rect_t d = s_scale_map.dst;
+        rect_t borders[4] = {
+            { 0, 0, s_width, d.y },
+            { 0, d.y + d.height, s_width, s_height - d.y - d.height },
+            { 0, d.y, d.x, d.height },
+            { d.x + d.width, d.y, s_width - d.x - d.width, d.height },
+        };
+        for (int i = 0; i < 4; i++) {
+            if (borders[i].width > 0 && borders[i].height > 0) {
+                present_fill(borders[i], 0);
+            }
+        }
+        s_scale_borders_dirty = false;
+    }
 
-    // Disable LCD panel
-    int cmd = 0;
-    while (ili_sleep_cmds[cmd].databytes != 0xff) {
-        ili_cmd(spi, ili_sleep_cmds[cmd].cmd);
-        ili_data(spi, ili_sleep_cmds[cmd].data, ili_sleep_cmds[cmd].databytes & 0x7f);
-        if (ili_sleep_cmds[cmd].databytes & 0x80) {
-            vTaskDelay(100 / portTICK_RATE_MS);
+    rect_t r = s_scale_map.dst;
+    s_scale_map.line_y[0] = -1;
+    s_scale_map.line_y[1] = -1;
+
+    send_reset_drawing(r.x, r.y, r.width, r.height);
+
+    for (short dy = 0; dy < r.height; dy += s_chunk_lines) {
+        display_slot_t *slot = ring_acquire();
+        short numLines = r.height - dy;
+        numLines = numLines < s_chunk_lines ? numLines : s_chunk_lines;
+
+        STATS_START(start);
+        for (short line = 0; line < numLines; line++) {
+            int y = dy + line;
+            int sy = s_scale_map.row_map[y];
+            const uint16_t *row0 = scale_get_line(src, sy, sy & 1);
+            uint16_t *dst = slot->buf + r.width * line;
+
+            if (scale == DISPLAY_SCALE_FILTERED) {
+                int weight = s_scale_map.row_frac[y];
+                const uint16_t *row1 = weight ? scale_get_line(src, sy + 1, (sy + 1) & 1) : row0;
+                scale_line_filtered(dst, row0, row1, weight, r.width);
+            } else {
+                scale_line_nearest(dst, row0, r.width);
+            }
         }
-        cmd++;
+        STATS_SINCE(copy_cycles, start);
+
+        ring_send(slot, slot->buf, r.width, numLines);
     }
 }
 
-void display_clear(uint16_t color)
+static void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xff;
+}
+
+// Program the panel's scroll area and start address. The panel scrolls along
+// its gate lines, our x axis in landscape; with MADCTL_MY set these run
+// opposite to it.
+static void present_scroll(const display_scroll_t *sc)
 {
-    xTaskToNotify = xTaskGetCurrentTaskHandle();
+    const bool reversed = (s_madctl & MADCTL_MY) != 0;
+    uint8_t data[6];
+    short top, area, bottom, vsp;
+
+    if (sc->length > 0) {
+        area = sc->length;
+        top = reversed ? TFT_PAGES - sc->start - sc->length : sc->start;
+        bottom = TFT_PAGES - top - area;
+        vsp = top + (reversed ? (sc->length - sc->offset) % sc->length : sc->offset);
+    } else {
+        top = 0;
+        area = TFT_PAGES;
+        bottom = 0;
+        vsp = 0;
+    }
+
+    if (sc->start != s_scroll.start || sc->length != s_scroll.length) {
+        put_be16(&data[0], top);
+        put_be16(&data[2], area);
+        put_be16(&data[4], bottom);
+        send_command(TFT_CMD_VSCRDEF, data, 6);
+    }
 
-    send_reset_drawing(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    put_be16(&data[0], vsp);
+    send_command(TFT_CMD_VSCRSADD, data, 2);
 
-    uint16_t *pbuf = get_pbuf();
+    s_scroll = *sc;
+}
 
-    // clear the buffer
-    for (int i = 0; i < DISPLAY_WIDTH * PARALLEL_LINES; i++) {
-        pbuf[i] = (color << 8) | (color >> 8);
+#if DISPLAY_STATS
+// Add the job's counters to the totals, and a present to the window
+static void stats_publish(bool frame, int64_t start_us)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_stats_lock);
+    s_stats.transactions += s_job_stats.transactions;
+    s_stats.bytes += s_job_stats.bytes;
+    s_stats.stall_cycles += s_job_stats.stall_cycles;
+    s_stats.copy_cycles += s_job_stats.copy_cycles;
+    s_stats.busy_cycles += s_job_stats.busy_cycles;
+    if (frame) {
+        int i = s_stats.frames % DISPLAY_STATS_WINDOW;
+        s_window_us[i] = now - start_us;
+        s_window_end[i] = now;
+        s_stats.frames++;
+        if (s_window_count < DISPLAY_STATS_WINDOW) {
+            s_window_count++;
+        }
     }
+    portEXIT_CRITICAL(&s_stats_lock);
+
+    memset(&s_job_stats, 0, sizeof(s_job_stats));
+}
+#endif
+
+static void present_task(void *arg)
+{
+    display_job_t job;
+
+    while (true) {
+        xQueueReceive(s_job_queue, &job, portMAX_DELAY);
+
+#if DISPLAY_STATS
+        int64_t start_us = esp_timer_get_time();
+        uint32_t start = xthal_get_ccount();
+        uint32_t start_fence = s_fence;
+#endif
+
+        if (job.type == DISPLAY_JOB_FRAME) {
+            // Take the latest frame, the one presented last becomes free
+            s_frame_front = atomic_exchange(&s_frame_middle, s_frame_front) & ~FRAME_FRESH;
+            job.type = DISPLAY_JOB_UPDATE;
+            job.src = s_frames[s_frame_front];
+        }
+
+        if (job.src) {
+            prepare_source(job.src);
+        }
+        s_bytes_sent = 0;
+
+        switch (job.type) {
+            case DISPLAY_JOB_UPDATE:
+                switch (job.mode) {
+                    case DISPLAY_PRESENT_TILE_DIFF:
+                        present_frame_diff(job.src);
+                        break;
+
+                    case DISPLAY_PRESENT_LINE_DIFF:
+                        present_frame_line_diff(job.src);
+                        break;
+
+                    case DISPLAY_PRESENT_INTERLACED:
+                        present_frame_interlaced(job.src);
+                        break;
+
+                    default:
+                        present_frame(job.src);
+                        break;
+                }
+                break;
+
+            case DISPLAY_JOB_UPDATE_RECT:
+                present_rect(job.src, job.rect);
+                break;
+
+            case DISPLAY_JOB_UPDATE_DAMAGE:
+                for (int i = 0; i < job.damage.count; i++) {
+                    present_rect(job.src, job.damage.rects[i]);
+                }
+                break;
+
+            case DISPLAY_JOB_UPDATE_SCALED:
+                present_scaled(job.src, job.scale, job.letterbox);
+                break;
+
+            case DISPLAY_JOB_CLEAR:
+                present_fill((rect_t){ 0, 0, s_width, s_height }, job.color);
+                break;
+
+            case DISPLAY_JOB_SCROLL:
+                present_scroll(&job.scroll);
+                break;
+
+            case DISPLAY_JOB_COMMANDS:
+                send_commands(job.cmds);
+                break;
+
+            case DISPLAY_JOB_FRAME:
+                // Turned into an update above
+                break;
+
+            case DISPLAY_JOB_ORIENTATION:
+                send_command(TFT_CMD_MADCTL, &job.madctl, 1);
+                s_madctl = job.madctl;
+                // The screen size may change, rebuild the map next time
+                s_scale_map.src_width = 0;
+                break;
+        }
+
+        // Wait for the last transfer, src may be read until then
+        ring_flush();
+
+        if (job.type == DISPLAY_JOB_UPDATE) {
+            s_frame_sent = s_bytes_sent;
+        }
+
+#if DISPLAY_STATS
+        STATS_SINCE(busy_cycles, start);
+        STATS_ADD(transactions, s_fence - start_fence);
+        // Clears, scrolls, commands and orientation changes are not frames
+        bool frame = job.type == DISPLAY_JOB_UPDATE || job.type == DISPLAY_JOB_UPDATE_RECT ||
+                     job.type == DISPLAY_JOB_UPDATE_DAMAGE || job.type == DISPLAY_JOB_UPDATE_SCALED;
+        stats_publish(frame, start_us);
+#endif
+
+        // The panel no longer matches the last diffed frame
+        if (job.type != DISPLAY_JOB_UPDATE || job.mode != DISPLAY_PRESENT_TILE_DIFF) {
+            s_tile_hash_valid = false;
+        }
+        if (job.type != DISPLAY_JOB_UPDATE || job.mode != DISPLAY_PRESENT_LINE_DIFF) {
+            s_line_hash_valid = false;
+        }
+        if (job.type != DISPLAY_JOB_UPDATE_SCALED) {
+            // Borders may have been drawn over, clear them next time
+            s_scale_borders_dirty = true;
+        }
 
-    // clear the screen
-    for (short dy = 0; dy < DISPLAY_HEIGHT; dy += PARALLEL_LINES) {
-        send_continue_line(pbuf, DISPLAY_WIDTH, PARALLEL_LINES);
+        portENTER_CRITICAL(&s_waiter_lock);
+        s_completed = job.fence;
+        EventBits_t waiters = s_waiter_mask;
+        portEXIT_CRITICAL(&s_waiter_lock);
+
+        if (waiters) {
+            xEventGroupSetBits(s_waiter_events, waiters);
+        }
     }
+}
+
+static display_fence_t submit_job(display_job_t *job)
+{
+    // Fences must reach the queue in order when several tasks submit
+    xSemaphoreTake(s_submit_lock, portMAX_DELAY);
+    display_fence_t fence = job->fence = ++s_submitted;
+
+    BaseType_t ret = xQueueSend(s_job_queue, job, portMAX_DELAY);
+    assert(ret == pdTRUE);
+    (void)ret;
+    xSemaphoreGive(s_submit_lock);
 
-    send_continue_wait();
+    return fence;
 }
 
-void display_update(void)
+void display_init(void)
 {
-    xTaskToNotify = xTaskGetCurrentTaskHandle();
+    display_config_t config = DISPLAY_CONFIG_DEFAULT();
+    display_init_config(&config);
+}
 
-    send_reset_drawing(0, 0, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+void display_init_config(const display_config_t *config)
+{
+    display_wait(display_init_async(config));
+}
 
-    for (short dy = 0; dy < DISPLAY_HEIGHT; dy += PARALLEL_LINES) {
-        uint16_t *pbuf = get_pbuf();
-        memcpy(pbuf, ((uint16_t *)fb->data) + DISPLAY_WIDTH * dy, DISPLAY_WIDTH * PARALLEL_LINES * sizeof(uint16_t));
-        send_continue_line(pbuf, DISPLAY_WIDTH, PARALLEL_LINES);
+display_fence_t display_init_async(const display_config_t *config)
+{
+    assert(config->chunk_lines > 0 && config->chunk_lines <= DISPLAY_HEIGHT);
+    assert(config->ring_depth > 0);
+    assert(config->fb_bytes_per_pixel == 1 || config->fb_bytes_per_pixel == 2);
+
+    s_chunk_lines = config->chunk_lines;
+    s_ring_depth = config->ring_depth;
+
+    // Prefer DMA-capable memory so presents can skip the bounce copy
+    fb = gbuf_new_caps(DISPLAY_WIDTH, DISPLAY_HEIGHT, config->fb_bytes_per_pixel, BIG_ENDIAN, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (!fb) {
+        fb = gbuf_new(DISPLAY_WIDTH, DISPLAY_HEIGHT, config->fb_bytes_per_pixel, BIG_ENDIAN);
+    }
+    memset(fb->data, 0, DISPLAY_WIDTH * DISPLAY_HEIGHT * config->fb_bytes_per_pixel);
+
+    // Initialize the chunk ring
+    s_slots = calloc(s_ring_depth, sizeof(display_slot_t));
+    if (!s_slots) abort();
+
+    for (int i = 0; i < s_ring_depth; i++) {
+        display_slot_t *slot = &s_slots[i];
+
+        slot->buf = heap_caps_malloc(DISPLAY_WIDTH * s_chunk_lines * sizeof(uint16_t), MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+        if (!slot->buf) abort();
     }
 
-    send_continue_wait();
+    s_backend = config->backend ? config->backend : &display_backend_spi;
+    s_backend->init(config);
+
+    s_job_queue = xQueueCreate(DISPLAY_JOB_QUEUE_LENGTH, sizeof(display_job_t));
+    if (!s_job_queue) abort();
+
+    s_submit_lock = xSemaphoreCreateMutex();
+    if (!s_submit_lock) abort();
+
+    s_waiter_events = xEventGroupCreate();
+    if (!s_waiter_events) abort();
+
+    BaseType_t res = xTaskCreatePinnedToCore(present_task, "display", DISPLAY_TASK_STACK_SIZE, NULL, DISPLAY_TASK_PRIORITY, &s_present_task, DISPLAY_TASK_CORE);
+    if (res != pdPASS) abort();
+
+    // The present task runs the init sequence, presents queue up behind it
+    display_job_t job = {
+        .type = DISPLAY_JOB_COMMANDS,
+        .cmds = ili_init_cmds,
+    };
+
+    return submit_job(&job);
 }
 
-void display_update_rect(rect_t r)
+void display_drain(void)
+{
+    // Wait for all submitted presents to finish, each of which leaves the
+    // SPI queue empty
+    display_wait(s_submitted);
+}
+
+void display_poweroff()
+{
+    // Disable LCD panel
+    display_job_t job = {
+        .type = DISPLAY_JOB_COMMANDS,
+        .cmds = ili_sleep_cmds,
+    };
+
+    display_wait(submit_job(&job));
+}
+
+bool display_poll(display_fence_t fence)
+{
+    return (int32_t)(s_completed - fence) >= 0;
+}
+
+void display_wait(display_fence_t fence)
+{
+    EventBits_t bit = 0;
+
+    portENTER_CRITICAL(&s_waiter_lock);
+    if (!display_poll(fence)) {
+        EventBits_t free = ~s_waiter_mask & ((1 << DISPLAY_WAITERS) - 1);
+        bit = free & -free;
+        s_waiter_mask |= bit;
+    }
+    portEXIT_CRITICAL(&s_waiter_lock);
+
+    while (!display_poll(fence)) {
+        if (bit) {
+            xEventGroupWaitBits(s_waiter_events, bit, pdTRUE, pdTRUE, portMAX_DELAY);
+        } else {
+            // More waiters than bits, poll
+            vTaskDelay(1);
+        }
+    }
+
+    if (bit) {
+        portENTER_CRITICAL(&s_waiter_lock);
+        s_waiter_mask &= ~bit;
+        portEXIT_CRITICAL(&s_waiter_lock);
+    }
+}
+
+gbuf_t *display_frames_init(int bytes_per_pixel)
+{
+    for (int i = 0; i < DISPLAY_FRAME_COUNT; i++) {
+        s_frames[i] = gbuf_new_caps(s_width, s_height, bytes_per_pixel, BIG_ENDIAN, MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+        if (!s_frames[i]) {
+            s_frames[i] = gbuf_new(s_width, s_height, bytes_per_pixel, BIG_ENDIAN);
+        }
+        memset(s_frames[i]->data, 0, DISPLAY_WIDTH * DISPLAY_HEIGHT * bytes_per_pixel);
+    }
+
+    return s_frames[s_frame_back];
+}
+
+gbuf_t *display_frame_submit(void)
+{
+    int last = atomic_exchange(&s_frame_middle, s_frame_back | FRAME_FRESH);
+    s_frame_back = last & ~FRAME_FRESH;
+
+    // A fresh frame replaced here was never presented: drop it, its job is
+    // still queued and picks up this frame instead
+    if (!(last & FRAME_FRESH)) {
+        display_job_t job = {
+            .type = DISPLAY_JOB_FRAME,
+            .mode = s_present_mode,
+        };
+        submit_job(&job);
+    }
+
+    return s_frames[s_frame_back];
+}
+
+display_fence_t display_clear_async(uint16_t color)
+{
+    display_job_t job = {
+        .type = DISPLAY_JOB_CLEAR,
+        .color = color,
+    };
+
+    return submit_job(&job);
+}
+
+display_fence_t display_update_async(void)
+{
+    display_job_t job = {
+        .type = DISPLAY_JOB_UPDATE,
+        .mode = s_present_mode,
+        .src = fb,
+    };
+
+    return submit_job(&job);
+}
+
+display_fence_t display_update_rect_async(rect_t r)
 {
     assert(r.x >= 0);
     assert(r.y >= 0);
     assert(r.width > 0);
     assert(r.height > 0);
-    assert(r.x + r.width <= DISPLAY_WIDTH);
-    assert(r.y + r.height <= DISPLAY_HEIGHT);
+    assert(r.x + r.width <= s_width);
+    assert(r.y + r.height <= s_height);
 
-    xTaskToNotify = xTaskGetCurrentTaskHandle();
+    display_job_t job = {
+        .type = DISPLAY_JOB_UPDATE_RECT,
+        .src = fb,
+        .rect = r,
+    };
 
-    send_reset_drawing(r.x, r.y, r.width, r.height);
+    return submit_job(&job);
+}
 
-    if (r.width == DISPLAY_WIDTH) {
-        for (short dy = 0; dy < r.height; dy += PARALLEL_LINES) {
-            uint16_t *pbuf = get_pbuf();
-            short numLines = r.height - dy;
-            numLines = numLines < PARALLEL_LINES ? numLines : PARALLEL_LINES; 
-            memcpy(pbuf, ((uint16_t *)fb->data) + DISPLAY_WIDTH * (r.y + dy) + r.x, r.width * numLines * sizeof(uint16_t));
-            send_continue_line(pbuf, r.width, numLines);
+void display_mark_dirty(rect_t r)
+{
+    // Clip to the screen
+    if (r.x < 0) {
+        r.width += r.x;
+        r.x = 0;
+    }
+    if (r.y < 0) {
+        r.height += r.y;
+        r.y = 0;
+    }
+    if (r.x + r.width > s_width) {
+        r.width = s_width - r.x;
+    }
+    if (r.y + r.height > s_height) {
+        r.height = s_height - r.y;
+    }
+
+    damage_add(&s_fb_damage, r);
+}
+
+void display_mark_dirty_cb(const gbuf_t *g, rect_t r, void *arg)
+{
+    const uint8_t *end = fb->data + fb->height * fb->stride;
+
+    // Drawing into a view of fb marks the same pixels of fb
+    if (g->data >= fb->data && g->data < end && g->stride == fb->stride) {
+        int offset = g->data - fb->data;
+        r.x += offset % fb->stride / fb->bytes_per_pixel;
+        r.y += offset / fb->stride;
+        display_mark_dirty(r);
+    }
+}
+
+display_fence_t display_update_dirty_async(void)
+{
+    display_job_t job = {
+        .type = DISPLAY_JOB_UPDATE_DAMAGE,
+        .src = fb,
+    };
+
+    damage_coalesce(&s_fb_damage);
+    job.damage = s_fb_damage;
+    damage_clear(&s_fb_damage);
+
+    return submit_job(&job);
+}
+
+display_fence_t display_update_scaled_async(const gbuf_t *src, display_scale_t scale, bool letterbox)
+{
+    display_job_t job = {
+        .type = DISPLAY_JOB_UPDATE_SCALED,
+        .src = src,
+        .scale = scale,
+        .letterbox = letterbox,
+    };
+
+    return submit_job(&job);
+}
+
+void display_scroll_define(short start, short length)
+{
+    // The panel only scrolls along x in the landscape orientations
+    assert(s_width == DISPLAY_WIDTH || length == 0);
+    assert(start >= 0 && length >= 0 && start + length <= s_width);
+
+    display_scroll_t sc = { start, length, 0 };
+    s_scroll_req = sc;
+
+    display_job_t job = {
+        .type = DISPLAY_JOB_SCROLL,
+        .scroll = sc,
+    };
+    submit_job(&job);
+
+    // Panel memory no longer lines up with fb
+    display_update_async();
+}
+
+rect_t display_scroll(short delta)
+{
+    display_scroll_t *sc = &s_scroll_req;
+    rect_t exposed = { sc->start, 0, 0, s_height };
+
+    assert(sc->length > 0);
+
+    // Nothing moves, and nothing is queued to wait for
+    if (delta == 0) {
+        return exposed;
+    }
+
+    // fb is about to be moved, it must not be in flight
+    display_wait(s_submitted);
+
+    int bpp = fb->bytes_per_pixel;
+    int n = delta > 0 ? delta : -delta;
+    if (n > sc->length) {
+        n = sc->length;
+    }
+
+    // Move the scrolled content of fb along with the panel's
+    for (int y = 0; y < s_height; y++) {
+        uint8_t *row = fb->data + y * fb->stride + sc->start * bpp;
+        if (delta > 0) {
+            memmove(row, row + n * bpp, (sc->length - n) * bpp);
+        } else {
+            memmove(row + n * bpp, row, (sc->length - n) * bpp);
         }
-    } else {
-        for (short dy = 0; dy < r.height; dy += PARALLEL_LINES) {
-            uint16_t *pbuf = get_pbuf();
-            short numLines = r.height - dy;
-            numLines = numLines < PARALLEL_LINES ? numLines : PARALLEL_LINES;
-            for (short line = 0; line < numLines; line++) {
-                memcpy(pbuf + r.width * line, ((uint16_t *)fb->data) + DISPLAY_WIDTH * (r.y + dy + line) + r.x, r.width * sizeof(uint16_t));
-            }
-            send_continue_line(pbuf, r.width, numLines);
+    }
+
+    exposed.x = delta > 0 ? sc->start + sc->length - n : sc->start;
+    exposed.width = n;
+
+    sc->offset = ((sc->offset + delta) % sc->length + sc->length) % sc->length;
+
+    display_job_t job = {
+        .type = DISPLAY_JOB_SCROLL,
+        .scroll = *sc,
+    };
+    submit_job(&job);
+
+    return exposed;
+}
+
+void display_set_orientation(display_orientation_t orientation, bool mirror)
+{
+    // Landscape keeps the panel's rows and columns exchanged. Turning the
+    // picture half way reverses both address orders, and mirroring x reverses
+    // the one x maps to.
+    static const uint8_t madctl[] = {
+        [DISPLAY_LANDSCAPE] = MADCTL_MV | MADCTL_MY,
+        [DISPLAY_PORTRAIT] = MADCTL_MX | MADCTL_MY,
+        [DISPLAY_LANDSCAPE_FLIPPED] = MADCTL_MV | MADCTL_MX,
+        [DISPLAY_PORTRAIT_FLIPPED] = 0,
+    };
+    const bool landscape = orientation == DISPLAY_LANDSCAPE || orientation == DISPLAY_LANDSCAPE_FLIPPED;
+
+    display_job_t job = {
+        .type = DISPLAY_JOB_ORIENTATION,
+        .madctl = madctl[orientation] | TFT_RGB_BGR,
+    };
+    if (mirror) {
+        job.madctl ^= landscape ? MADCTL_MY : MADCTL_MX;
+    }
+
+    // The size changes under fb, nothing may be in flight
+    display_wait(s_submitted);
+
+    if (s_scroll_req.length > 0) {
+        display_scroll_t none = { 0, 0, 0 };
+        display_job_t scroll = {
+            .type = DISPLAY_JOB_SCROLL,
+            .scroll = none,
+        };
+        s_scroll_req = none;
+        submit_job(&scroll);
+    }
+
+    s_width = landscape ? DISPLAY_WIDTH : DISPLAY_HEIGHT;
+    s_height = landscape ? DISPLAY_HEIGHT : DISPLAY_WIDTH;
+
+    // Same pixels, new shape
+    fb->width = s_width;
+    fb->height = s_height;
+    fb->stride = s_width * fb->bytes_per_pixel;
+    for (int i = 0; i < DISPLAY_FRAME_COUNT; i++) {
+        if (s_frames[i]) {
+            s_frames[i]->width = s_width;
+            s_frames[i]->height = s_height;
+            s_frames[i]->stride = s_width * s_frames[i]->bytes_per_pixel;
+        }
+    }
+    damage_clear(&s_fb_damage);
+
+    submit_job(&job);
+}
+
+short display_width(void)
+{
+    return s_width;
+}
+
+short display_height(void)
+{
+    return s_height;
+}
+
+void display_set_present_mode(display_present_mode_t mode)
+{
+    s_present_mode = mode;
+}
+
+void display_get_frame_bytes(uint32_t *sent, uint32_t *saved)
+{
+    uint32_t n = s_frame_sent;
+
+    if (sent) {
+        *sent = n;
+    }
+    if (saved) {
+        *saved = DISPLAY_WIDTH * DISPLAY_HEIGHT * 2 - n;
+    }
+}
+
+void display_get_stats(display_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+#if DISPLAY_STATS
+    portENTER_CRITICAL(&s_stats_lock);
+    *stats = s_stats;
+    if (s_window_count > 1) {
+        int last = (s_stats.frames - 1) % DISPLAY_STATS_WINDOW;
+        int first = (s_stats.frames - s_window_count) % DISPLAY_STATS_WINDOW;
+        int64_t elapsed = s_window_end[last] - s_window_end[first];
+        if (elapsed > 0) {
+            stats->fps = (s_window_count - 1) * 1000000.0f / elapsed;
+        }
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+#endif
+}
+
+void display_get_histogram(display_histogram_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+
+#if DISPLAY_STATS
+    portENTER_CRITICAL(&s_stats_lock);
+    hist->count = s_window_count;
+    hist->min_us = UINT32_MAX;
+    for (int i = 0; i < s_window_count; i++) {
+        uint32_t us = s_window_us[i];
+        int bucket = 0;
+        while (bucket < DISPLAY_STATS_BUCKETS - 1 && (us >> (bucket + 1)) != 0) {
+            bucket++;
+        }
+        hist->buckets[bucket]++;
+        hist->min_us = us < hist->min_us ? us : hist->min_us;
+        hist->max_us = us > hist->max_us ? us : hist->max_us;
+    }
+    if (s_window_count == 0) {
+        hist->min_us = 0;
+    }
+    portEXIT_CRITICAL(&s_stats_lock);
+#endif
+}
+
+void display_reset_stats(void)
+{
+#if DISPLAY_STATS
+    portENTER_CRITICAL(&s_stats_lock);
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_window_count = 0;
+    portEXIT_CRITICAL(&s_stats_lock);
+#endif
+}
+
+void display_dump_stats(void)
+{
+    display_stats_t stats;
+    display_histogram_t hist;
+
+    display_get_stats(&stats);
+    display_get_histogram(&hist);
+
+    printf("display: %u frames, %.1f fps, %u transactions, %llu bytes\n",
+        stats.frames, stats.fps, stats.transactions, (unsigned long long)stats.bytes);
+    printf("display: busy %llu, stall %llu, copy %llu cycles\n",
+        (unsigned long long)stats.busy_cycles, (unsigned long long)stats.stall_cycles,
+        (unsigned long long)stats.copy_cycles);
+    printf("display: last %u presents %u-%u us\n", hist.count, hist.min_us, hist.max_us);
+    for (int i = 0; i < DISPLAY_STATS_BUCKETS; i++) {
+        if (hist.buckets[i]) {
+            printf("display: %6u us+ %u\n", i ? 1u << i : 0, hist.buckets[i]);
         }
     }
+}
+
+void display_set_dither(bool enable)
+{
+    s_dither = enable;
+}
+
+void display_clear(uint16_t color)
+{
+    display_wait(display_clear_async(color));
+}
+
+void display_update(void)
+{
+    display_wait(display_update_async());
+}
 
-    send_continue_wait();
+void display_update_rect(rect_t r)
+{
+    display_wait(display_update_rect_async(r));
+}
+
+void display_update_dirty(void)
+{
+    display_wait(display_update_dirty_async());
+}
+
+void display_update_scaled(const gbuf_t *src, display_scale_t scale, bool letterbox)
+{
+    display_wait(display_update_scaled_async(src, scale, letterbox));
 }
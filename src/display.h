@@ -1,18 +1,181 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "damage.h"
 #include "gbuf.h"
 #include "rect.h"
 
 #define DISPLAY_WIDTH (320)
 #define DISPLAY_HEIGHT (240)
 
-gbuf_t *fb;
+extern gbuf_t *fb;
+
+/* Pipeline counters, on by default. Build with DISPLAY_STATS=0 to compile
+ * them out; the stats calls then report zeros. */
+#ifndef DISPLAY_STATS
+#define DISPLAY_STATS (1)
+#endif
+
+#define DISPLAY_STATS_WINDOW (64)
+#define DISPLAY_STATS_BUCKETS (16)
+
+/* Presents are streamed to the panel by a background task. The async calls
+ * return a fence that completes once the source buffer (the fb at the time of
+ * the call) is no longer read, so the caller may swap fb to another gbuf and
+ * render the next frame meanwhile. The blocking calls wait on their fence.
+ * Any number of tasks may submit and wait. */
+typedef uint32_t display_fence_t;
+
+typedef struct display_backend display_backend_t;
+
+/* Frames are sent in chunks of chunk_lines full-width lines, each copied into
+ * one of ring_depth DMA buffers. Deeper rings keep more chunks queued on the
+ * SPI bus back-to-back. fb_bytes_per_pixel selects an RGB16 (2) or indexed
+ * (1) fb; indexed pixels are expanded through fb->palette while sending.
+ * backend is the panel transport, NULL for the ILI9341 over SPI. */
+typedef struct {
+    int chunk_lines;
+    int ring_depth;
+    int fb_bytes_per_pixel;
+    const display_backend_t *backend;
+} display_config_t;
+
+#define DISPLAY_CONFIG_DEFAULT() { .chunk_lines = 8, .ring_depth = 3, .fb_bytes_per_pixel = 2 }
+
+/* How display_update() sends fb, for frames that don't fit the SPI budget.
+ *  - tile diff: fb is hashed in 16x16 tiles and only tiles that differ from
+ *    the last diffed frame are sent, for callers that redraw everything but
+ *    change little.
+ *  - line diff: the same per line, sending runs of changed lines.
+ *  - interlaced: even and odd lines on alternate frames, halving the bytes.
+ * Any other present resets the diff modes' comparison, so the next diffed
+ * frame is sent in full. */
+typedef enum {
+    DISPLAY_PRESENT_FULL,
+    DISPLAY_PRESENT_TILE_DIFF,
+    DISPLAY_PRESENT_LINE_DIFF,
+    DISPLAY_PRESENT_INTERLACED,
+} display_present_mode_t;
+
+/* Scaling modes for display_update_scaled(). Nearest and filtered stretch the
+ * source to the screen, or to the largest rect with the source aspect ratio
+ * when letterboxed. Integer uses the largest whole multiple that fits and is
+ * always centered. */
+typedef enum {
+    DISPLAY_SCALE_NEAREST,
+    DISPLAY_SCALE_INTEGER,
+    DISPLAY_SCALE_FILTERED,
+} display_scale_t;
 
 void display_init(void);
+void display_init_config(const display_config_t *config);
+/* Start the panel's init sequence in the background and return its fence, so
+ * other boot work can overlap the reset and sleep out delays. Presents may be
+ * submitted right away; they are sent once the panel is up. */
+display_fence_t display_init_async(const display_config_t *config);
 void display_poweroff(void);
 void display_clear(uint16_t color);
 void display_update(void);
 void display_update_rect(rect_t r);
 void display_drain(void);
+/* Orientation, set by reprogramming the panel's memory access control so
+ * frames need no rotating. Landscape is DISPLAY_WIDTH x DISPLAY_HEIGHT and
+ * portrait the other way round, with its top at the landscape left edge;
+ * the flipped variants are turned half way. mirror flips the picture along
+ * x. fb and the frame queue buffers are reshaped in place, so redraw them
+ * after a change. Hardware scrolling is turned off. */
+typedef enum {
+    DISPLAY_LANDSCAPE,
+    DISPLAY_PORTRAIT,
+    DISPLAY_LANDSCAPE_FLIPPED,
+    DISPLAY_PORTRAIT_FLIPPED,
+} display_orientation_t;
+
+void display_set_orientation(display_orientation_t orientation, bool mirror);
+/* The logical screen size in the current orientation */
+short display_width(void);
+short display_height(void);
+
+/* Hardware scrolling. The panel scrolls along its scan direction, which is
+ * the x axis in this orientation. display_scroll_define() sets the scrolled
+ * columns (length 0 turns scrolling off) and resends fb. display_scroll()
+ * moves the area's content by delta columns towards x = 0 (away from it if
+ * negative), both on the panel and in fb, and returns the newly exposed
+ * columns: draw them into fb and present them with display_update_rect().
+ * A delta of 0 returns at once with an empty rect (width 0), which needs no
+ * present. Presents of fb map through the scroll offset; scaled presents do
+ * not.
+ * Only available in the landscape orientations. */
+void display_scroll_define(short start, short length);
+rect_t display_scroll(short delta);
+
+void display_set_present_mode(display_present_mode_t mode);
+/* Pixel bytes sent by the last display_update() and saved against a full
+ * frame. */
+void display_get_frame_bytes(uint32_t *sent, uint32_t *saved);
+/* Use ordered dithering when sending RGB888/RGBA8888 gbufs. */
+void display_set_dither(bool enable);
+
+/* Drawing code marks the regions of fb it changed; display_update_dirty()
+ * merges them where one larger window is cheaper than several small ones and
+ * sends the result. */
+void display_mark_dirty(rect_t r);
+/* Damage callback for raster_register_damage_callback(), marks drawing to fb */
+void display_mark_dirty_cb(const gbuf_t *g, rect_t r, void *arg);
+void display_update_dirty(void);
+
+/* Present a gbuf of any size and pixel format, scaling it on the fly. */
+void display_update_scaled(const gbuf_t *src, display_scale_t scale, bool letterbox);
+
+display_fence_t display_clear_async(uint16_t color);
+display_fence_t display_update_async(void);
+display_fence_t display_update_rect_async(rect_t r);
+display_fence_t display_update_dirty_async(void);
+display_fence_t display_update_scaled_async(const gbuf_t *src, display_scale_t scale, bool letterbox);
+
+/* Triple-buffered frame queue, for a renderer running on the other core than
+ * the present task. display_frames_init() allocates the buffers and returns
+ * the first one to render into. display_frame_submit() hands over a finished
+ * frame and returns the next buffer, never waiting: a frame that is replaced
+ * before the present task gets to it is dropped, so the panel is at most one
+ * frame behind. Buffers are recycled, render every frame in full. */
+#define DISPLAY_FRAME_COUNT (3)
+
+gbuf_t *display_frames_init(int bytes_per_pixel);
+gbuf_t *display_frame_submit(void);
+bool display_poll(display_fence_t fence);
+void display_wait(display_fence_t fence);
+
+/* Totals since the last display_reset_stats(). Transactions and bytes are
+ * those handed to the backend, bytes without the transport's framing. Cycles
+ * are CPU cycles of the present task: stalled in the backend waiting for
+ * transfers, copying or converting pixels into DMA buffers, and busy running
+ * presents (including both). fps is over the last DISPLAY_STATS_WINDOW
+ * presents. */
+typedef struct {
+    uint32_t frames;
+    uint32_t transactions;
+    uint64_t bytes;
+    uint64_t stall_cycles;
+    uint64_t copy_cycles;
+    uint64_t busy_cycles;
+    float fps;
+} display_stats_t;
+
+/* Present durations over the last DISPLAY_STATS_WINDOW presents. Bucket i
+ * counts presents that took [2^i, 2^(i+1)) us, the first and last buckets
+ * also take anything shorter or longer. */
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t buckets[DISPLAY_STATS_BUCKETS];
+} display_histogram_t;
+
+void display_get_stats(display_stats_t *stats);
+void display_get_histogram(display_histogram_t *hist);
+void display_reset_stats(void);
+/* Print the stats and histogram to stdout */
+void display_dump_stats(void);
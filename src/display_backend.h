@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "display.h"
+
+/* Panel transport behind the present task. Only the present task calls these.
+ *
+ * Every call queues a transfer and returns its fence, an increasing sequence
+ * number. wait() blocks until the transfers up to a fence are done; until
+ * then the pixels and data passed in must stay untouched.
+ *
+ *  - window: set the panel memory window and start a memory write there.
+ *  - pixels: stream count RGB565 pixels in panel byte order into the window,
+ *    continuing where the last call stopped.
+ *  - command: send a panel command with len bytes of arguments. */
+struct display_backend {
+    void (*init)(const display_config_t *config);
+    uint32_t (*window)(short x, short y, short width, short height);
+    uint32_t (*pixels)(const uint16_t *pixels, int count);
+    uint32_t (*command)(uint8_t cmd, const uint8_t *data, int len);
+    void (*wait)(uint32_t fence);
+};
+
+/* The ILI9341 on the HSPI bus. Host builds add an in-memory panel, see
+ * test/host/display_host.h. */
+extern const display_backend_t display_backend_spi;
@@ -0,0 +1,301 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "display.h"
+#include "display_capture.h"
+#include "pixel.h"
+#include "platform.h"
+
+#define CAPTURE_CHUNK_LINES (8)
+#define CAPTURE_MAX_RUNS (32)
+
+/*
+ Capture stream, all values little endian:
+   header: "FBC1", uint16 width, uint16 height
+   frame:  uint32 time in ms since the start, uint16 run count
+   run:    uint16 y, uint16 lines, then lines * width RGB565 pixels
+*/
+static FILE *s_stream = NULL;
+static uint16_t *s_chunk = NULL;
+static uint16_t s_palette[GBUF_PALETTE_SIZE];
+static uint32_t *s_row_hash = NULL;
+static bool s_row_hash_valid = false;
+static uint32_t s_palette_hash;
+static int s_width;
+static int s_height;
+static int s_max_rows;
+static int s_next_row;
+static int64_t s_start_us;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+// Latch the palette of an indexed src in little endian order
+static void prepare_palette(const gbuf_t *src)
+{
+    if (src->bytes_per_pixel != 1) {
+        return;
+    }
+
+    for (int i = 0; i < GBUF_PALETTE_SIZE; i++) {
+        s_palette[i] = src->endian == LITTLE_ENDIAN ? src->palette[i] : pixel_bswap16(src->palette[i]);
+    }
+}
+
+// Write lines rows of src starting at y as little endian RGB565, a chunk at
+// a time. Rows are pitch pixels apart in the file and in chunk, which holds
+// CAPTURE_CHUNK_LINES of them; padding pixels are written as zero.
+static bool write_rows(FILE *f, const gbuf_t *src, int y, int lines, uint16_t *chunk, int pitch)
+{
+    while (lines > 0) {
+        int n = lines < CAPTURE_CHUNK_LINES ? lines : CAPTURE_CHUNK_LINES;
+        int count = n * pitch;
+
+        for (int line = 0; line < n; line++) {
+            const uint8_t *p = src->data + (y + line) * src->stride;
+            uint16_t *dst = chunk + line * pitch;
+
+            if (src->bytes_per_pixel == 1) {
+                pixel_expand_indexed(dst, p, s_palette, src->width);
+            } else if (src->endian == LITTLE_ENDIAN) {
+                memcpy(dst, p, src->width * sizeof(uint16_t));
+            } else {
+                pixel_swap16(dst, (const uint16_t *)p, src->width);
+            }
+            for (int x = src->width; x < pitch; x++) {
+                dst[x] = 0;
+            }
+        }
+
+        if (fwrite(chunk, sizeof(uint16_t), count, f) != count) {
+            return false;
+        }
+
+        y += n;
+        lines -= n;
+    }
+
+    return true;
+}
+
+esp_err_t display_capture(const gbuf_t *src, const char *path)
+{
+    assert(src->bytes_per_pixel <= 2);
+
+    // Top-down 16-bit BMP with RGB565 bit fields. Rows are padded to a whole
+    // number of words, one pixel for odd widths.
+    const int pitch = (src->width + 1) & ~1;
+    const uint32_t image_size = pitch * src->height * 2;
+    uint8_t header[66] = { 'B', 'M' };
+    put_le32(&header[2], sizeof(header) + image_size);
+    put_le32(&header[10], sizeof(header));
+    put_le32(&header[14], 40);
+    put_le32(&header[18], src->width);
+    put_le32(&header[22], -(int32_t)src->height);
+    put_le16(&header[26], 1);
+    put_le16(&header[28], 16);
+    put_le32(&header[30], 3); // BI_BITFIELDS
+    put_le32(&header[34], image_size);
+    put_le32(&header[54], 0xf800);
+    put_le32(&header[58], 0x07e0);
+    put_le32(&header[62], 0x001f);
+
+    // Sized for src, which may be wider than the stream's buffer
+    uint16_t *chunk = malloc(pitch * CAPTURE_CHUNK_LINES * sizeof(uint16_t));
+    if (!chunk) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    FILE *f = fopen(path, "wb");
+    bool ok = f != NULL;
+    if (ok) {
+        prepare_palette(src);
+        ok = fwrite(header, 1, sizeof(header), f) == sizeof(header) &&
+             write_rows(f, src, 0, src->height, chunk, pitch);
+        ok = (fclose(f) == 0) && ok;
+    }
+
+    free(chunk);
+
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t display_capture_start(const char *path, int max_rows)
+{
+    if (s_stream) {
+        return ESP_FAIL;
+    }
+
+    // Sized for the longer side, which DISPLAY_WIDTH is
+    s_chunk = malloc(DISPLAY_WIDTH * CAPTURE_CHUNK_LINES * sizeof(uint16_t));
+    s_row_hash = malloc(DISPLAY_WIDTH * sizeof(uint32_t));
+    if (!s_chunk || !s_row_hash) {
+        display_capture_stop();
+        return ESP_ERR_NO_MEM;
+    }
+
+    s_stream = fopen(path, "wb");
+    if (!s_stream) {
+        display_capture_stop();
+        return ESP_FAIL;
+    }
+
+    s_width = 0;
+    s_height = 0;
+    s_max_rows = max_rows;
+    s_next_row = 0;
+    s_row_hash_valid = false;
+    s_start_us = esp_timer_get_time();
+
+    return ESP_OK;
+}
+
+// FNV-1a over the row a word at a time, then its last bytes. Rows of views
+// and odd widths need not be word aligned; their words go through memcpy.
+static uint32_t hash_row(const gbuf_t *src, int y)
+{
+    const int size = src->width * src->bytes_per_pixel;
+    const uint8_t *p = src->data + y * src->stride;
+    uint32_t h = 2166136261u;
+    int i = 0;
+
+    if (((uintptr_t)p & 3) == 0) {
+        for (; i + 4 <= size; i += 4) {
+            h = (h ^ *(const uint32_t *)(p + i)) * 16777619u;
+        }
+    } else {
+        for (; i + 4 <= size; i += 4) {
+            uint32_t word;
+            memcpy(&word, p + i, 4);
+            h = (h ^ word) * 16777619u;
+        }
+    }
+    for (; i < size; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+esp_err_t display_capture_frame(const gbuf_t *src)
+{
+    uint8_t header[8];
+
+    if (!s_stream) {
+        return ESP_FAIL;
+    }
+
+    assert(src->bytes_per_pixel <= 2);
+    assert(src->width <= DISPLAY_WIDTH && src->height <= DISPLAY_WIDTH);
+
+    if (s_width == 0) {
+        memcpy(header, "FBC1", 4);
+        put_le16(&header[4], src->width);
+        put_le16(&header[6], src->height);
+        if (fwrite(header, 1, 8, s_stream) != 8) {
+            return ESP_FAIL;
+        }
+        s_width = src->width;
+        s_height = src->height;
+    }
+
+    // The stream has one size
+    if (src->width != s_width || src->height != s_height) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    prepare_palette(src);
+
+    // A palette change may change every row
+    if (src->bytes_per_pixel == 1) {
+        uint32_t h = 2166136261u;
+        for (int i = 0; i < GBUF_PALETTE_SIZE; i++) {
+            h = (h ^ s_palette[i]) * 16777619u;
+        }
+        if (h != s_palette_hash) {
+            s_row_hash_valid = false;
+            s_palette_hash = h;
+        }
+    }
+
+    // Make every row differ from its stored hash, so all are written
+    if (!s_row_hash_valid) {
+        for (int i = 0; i < s_height; i++) {
+            s_row_hash[i] = ~hash_row(src, i);
+        }
+        s_row_hash_valid = true;
+    }
+
+    // Collect runs of changed rows within the row budget, starting where the
+    // last frame stopped so no row waits forever
+    uint16_t runs[CAPTURE_MAX_RUNS][2];
+    int count = 0;
+    int rows = 0;
+    int y = s_next_row;
+
+    for (int i = 0; i < s_height && rows < s_max_rows; i++, y = (y + 1) % s_height) {
+        uint32_t h = hash_row(src, y);
+        if (h == s_row_hash[y]) {
+            continue;
+        }
+
+        if (count > 0 && runs[count - 1][0] + runs[count - 1][1] == y) {
+            runs[count - 1][1]++;
+        } else if (count < CAPTURE_MAX_RUNS) {
+            runs[count][0] = y;
+            runs[count][1] = 1;
+            count++;
+        } else {
+            break;
+        }
+
+        s_row_hash[y] = h;
+        rows++;
+    }
+
+    s_next_row = y;
+
+    put_le32(&header[0], (esp_timer_get_time() - s_start_us) / 1000);
+    put_le16(&header[4], count);
+    if (fwrite(header, 1, 6, s_stream) != 6) {
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        uint8_t run[4];
+        put_le16(&run[0], runs[i][0]);
+        put_le16(&run[2], runs[i][1]);
+        if (fwrite(run, 1, 4, s_stream) != 4 || !write_rows(s_stream, src, runs[i][0], runs[i][1], s_chunk, s_width)) {
+            return ESP_FAIL;
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t display_capture_stop(void)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (s_stream && fclose(s_stream) != 0) {
+        ret = ESP_FAIL;
+    }
+    s_stream = NULL;
+
+    free(s_chunk);
+    s_chunk = NULL;
+    free(s_row_hash);
+    s_row_hash = NULL;
+
+    return ret;
+}
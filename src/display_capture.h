@@ -0,0 +1,21 @@
+#pragma once
+
+#include "esp_err.h"
+#include "gbuf.h"
+
+/* Screenshots and frame captures of RGB16 or indexed gbufs, usually fb,
+ * written to a file (on the card mounted by sdcard_init()). Pixels are
+ * converted in chunks of a few lines, so no second frame buffer is needed. */
+
+/* Write src as a 16-bit BMP */
+esp_err_t display_capture(const gbuf_t *src, const char *path);
+
+/* Capture stream: consecutive frames, each holding only the rows that
+ * changed since they were last written. Call display_capture_frame() once
+ * per presented frame. At most max_rows rows are written per call to keep
+ * the frame rate up; further changed rows are written by the next calls,
+ * so a busy capture lags a few frames behind in places. See
+ * tools/capture_decode.py for the format. */
+esp_err_t display_capture_start(const char *path, int max_rows);
+esp_err_t display_capture_frame(const gbuf_t *src);
+esp_err_t display_capture_stop(void);
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+#include "display_backend.h"
+#include "ili9341.h"
+#include "platform.h"
+
+
+static const gpio_num_t SPI_PIN_NUM_MISO = GPIO_NUM_19;
+static const gpio_num_t SPI_PIN_NUM_MOSI = GPIO_NUM_23;
+static const gpio_num_t SPI_PIN_NUM_CLK  = GPIO_NUM_18;
+
+static const gpio_num_t LCD_PIN_NUM_CS   = GPIO_NUM_5;
+static const gpio_num_t LCD_PIN_NUM_DC   = GPIO_NUM_21;
+const int LCD_SPI_CLOCK_RATE = SPI_MASTER_FREQ_40M;
+
+/*
+ Transactions are taken round-robin from a pool as large as the device queue.
+ An entry is reused once the transaction queued pool size entries earlier has
+ finished, which the queue limit already guarantees. Command arguments are
+ copied to the entry so callers need not keep them.
+*/
+typedef struct {
+    spi_transaction_t trans;
+    uint8_t data[16] __attribute__((aligned(4)));
+} spi_pool_entry_t;
+
+static spi_device_handle_t spi;
+static spi_pool_entry_t *s_pool = NULL;
+static int s_pool_size;
+static uint32_t s_queued = 0;
+static uint32_t s_reclaimed = 0;
+
+// This function is called (in irq context!) just before a transmission starts.
+// It will set the D/C line to the value indicated in the user field.
+static void ili_spi_pre_transfer_callback(spi_transaction_t *t)
+{
+    int dc = (intptr_t)t->user;
+    gpio_set_level(LCD_PIN_NUM_DC, dc);
+}
+
+// Wait until the transaction with sequence number seq has completed, collecting
+// results in queue order.
+static void spi_wait(uint32_t seq)
+{
+    while ((int32_t)(s_reclaimed - seq) < 0) {
+        spi_transaction_t *t;
+        esp_err_t ret = spi_device_get_trans_result(spi, &t, portMAX_DELAY);
+        assert(ret == ESP_OK);
+        s_reclaimed++;
+    }
+}
+
+// Get a cleared transaction for the next queue entry
+static spi_transaction_t *spi_next(int dc)
+{
+    // Never have more transactions outstanding than the device queue holds
+    spi_wait(s_queued + 1 - s_pool_size);
+
+    spi_transaction_t *t = &s_pool[s_queued % s_pool_size].trans;
+    memset(t, 0, sizeof(*t));
+    t->user = (void*)(intptr_t)dc;
+    return t;
+}
+
+static uint32_t spi_queue(spi_transaction_t *t)
+{
+    esp_err_t ret = spi_device_queue_trans(spi, t, 1000 / portTICK_RATE_MS);
+    assert(ret == ESP_OK);
+    return ++s_queued;
+}
+
+static uint32_t spi_queue_cmd(uint8_t cmd)
+{
+    spi_transaction_t *t = spi_next(0);
+    t->length = 8;
+    t->tx_data[0] = cmd;
+    t->flags = SPI_TRANS_USE_TXDATA;
+    return spi_queue(t);
+}
+
+static uint32_t spi_queue_data(const uint8_t *data, int len)
+{
+    spi_transaction_t *t = spi_next(1);
+    spi_pool_entry_t *entry = (spi_pool_entry_t *)t;
+
+    assert(len <= sizeof(entry->data));
+    memcpy(entry->data, data, len);
+    t->length = len * 8;
+    t->tx_buffer = entry->data;
+    return spi_queue(t);
+}
+
+static void spi_init(const display_config_t *config)
+{
+    // A window (5 transactions) plus a command and data per ring slot
+    s_pool_size = 5 + 2 * config->ring_depth;
+    s_pool = heap_caps_calloc(s_pool_size, sizeof(spi_pool_entry_t), MALLOC_CAP_DMA | MALLOC_CAP_8BIT);
+    if (!s_pool) abort();
+
+    // Initialize SPI
+    esp_err_t ret;
+    spi_bus_config_t buscfg;
+
+    memset(&buscfg, 0, sizeof(buscfg));
+
+    buscfg.miso_io_num = SPI_PIN_NUM_MISO;
+    buscfg.mosi_io_num = SPI_PIN_NUM_MOSI;
+    buscfg.sclk_io_num = SPI_PIN_NUM_CLK;
+    buscfg.quadwp_io_num = -1;
+    buscfg.quadhd_io_num = -1;
+    buscfg.max_transfer_sz = DISPLAY_WIDTH * config->chunk_lines * sizeof(uint16_t);
+
+    spi_device_interface_config_t devcfg;
+
+    memset(&devcfg, 0, sizeof(devcfg));
+
+    devcfg.clock_speed_hz = LCD_SPI_CLOCK_RATE;
+    devcfg.mode = 0;                                // SPI mode 0
+    devcfg.spics_io_num = LCD_PIN_NUM_CS;           // CS pin
+    devcfg.queue_size = s_pool_size;                // The whole transaction pool
+    devcfg.pre_cb = ili_spi_pre_transfer_callback;  // Specify pre-transfer callback to handle D/C line
+    devcfg.flags = SPI_DEVICE_NO_DUMMY;
+
+    ret = spi_bus_initialize(HSPI_HOST, &buscfg, 1);
+    assert(ret == ESP_OK);
+
+    ret = spi_bus_add_device(HSPI_HOST, &devcfg, &spi);
+    assert(ret == ESP_OK);
+
+    gpio_set_direction(LCD_PIN_NUM_DC, GPIO_MODE_OUTPUT);
+}
+
+static uint32_t spi_window(short x, short y, short width, short height)
+{
+    uint8_t col[4] = { x >> 8, x & 0xff, (x + width - 1) >> 8, (x + width - 1) & 0xff };
+    uint8_t page[4] = { y >> 8, y & 0xff, (y + height - 1) >> 8, (y + height - 1) & 0xff };
+    spi_transaction_t *t;
+
+    spi_queue_cmd(TFT_CMD_CASET);     // Column Address Set
+    t = spi_next(1);
+    t->length = 8 * 4;
+    memcpy(t->tx_data, col, 4);
+    t->flags = SPI_TRANS_USE_TXDATA;
+    spi_queue(t);
+
+    spi_queue_cmd(TFT_CMD_PASET);     // Page address set
+    t = spi_next(1);
+    t->length = 8 * 4;
+    memcpy(t->tx_data, page, 4);
+    t->flags = SPI_TRANS_USE_TXDATA;
+    spi_queue(t);
+
+    return spi_queue_cmd(TFT_CMD_RAMWR); // Memory write
+}
+
+static uint32_t spi_pixels(const uint16_t *pixels, int count)
+{
+    spi_queue_cmd(TFT_CMD_RAMWR_CONTINUE); // Memory write continue
+
+    spi_transaction_t *t = spi_next(1);
+    t->tx_buffer = pixels;
+    t->length = count * 16;           // Data length, in bits
+    return spi_queue(t);
+}
+
+static uint32_t spi_command(uint8_t cmd, const uint8_t *data, int len)
+{
+    uint32_t fence = spi_queue_cmd(cmd);
+
+    if (len > 0) {
+        fence = spi_queue_data(data, len);
+    }
+
+    return fence;
+}
+
+const display_backend_t display_backend_spi = {
+    .init = spi_init,
+    .window = spi_window,
+    .pixels = spi_pixels,
+    .command = spi_command,
+    .wait = spi_wait,
+};
@@ -0,0 +1,263 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "font.h"
+#include "pixel.h"
+#include "raster.h"
+
+/* Walk the runs of set pixels of glyph; store them if spans is not NULL.
+ * Returns the number of runs. */
+static int glyph_spans(const font_t *font, int glyph, font_span_t *spans)
+{
+    int pitch = (font->max_width + 7) / 8;
+    const uint8_t *rows = font->bitmap + glyph * font->height * pitch;
+    int n = 0;
+
+    for (int y = 0; y < font->height; y++) {
+        const uint8_t *row = rows + y * pitch;
+        int start = -1;
+        for (int x = 0; x <= font->max_width; x++) {
+            bool set = x < font->max_width && (row[x >> 3] & (0x80 >> (x & 7)));
+            if (set && start < 0) {
+                start = x;
+            } else if (!set && start >= 0) {
+                if (spans) {
+                    spans[n].y = y;
+                    spans[n].x = start;
+                    spans[n].width = x - start;
+                }
+                n++;
+                start = -1;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* Spans of all glyphs, which span_index must be able to address */
+static size_t font_span_count(const font_t *font)
+{
+    size_t total = 0;
+    for (int i = 0; i < font->count; i++) {
+        total += glyph_spans(font, i, NULL);
+    }
+    return total;
+}
+
+font_t *font_load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    uint8_t header[8];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "OGF1", 4) != 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t height = header[4];
+    uint8_t first = header[5];
+    uint8_t count = header[6];
+    uint8_t max_width = header[7];
+    size_t bitmap_size = (size_t)count * height * ((max_width + 7) / 8);
+
+    /* One allocation for the font, its widths and its bitmaps */
+    font_t *font = calloc(1, sizeof(font_t) + count + bitmap_size);
+    if (!font) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t *widths = (uint8_t *)(font + 1);
+    uint8_t *bitmap = widths + count;
+    if (fread(widths, 1, count + bitmap_size, f) != count + bitmap_size) {
+        free(font);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    font->height = height;
+    font->first = first;
+    font->count = count;
+    font->max_width = max_width;
+    font->widths = widths;
+    font->bitmap = bitmap;
+
+    /* Refuse fonts the glyph cache could not index, rather than failing to
+     * draw them later */
+    if (font_span_count(font) > UINT16_MAX) {
+        free(font);
+        return NULL;
+    }
+
+    return font;
+}
+
+void font_free(font_t *font)
+{
+    free(font->span_index);
+    free(font->spans);
+    free(font);
+}
+
+static bool font_prepare(font_t *font)
+{
+    if (font->spans) {
+        return true;
+    }
+
+    font->span_index = malloc((font->count + 1) * sizeof(uint16_t));
+    if (!font->span_index) {
+        return false;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < font->count; i++) {
+        font->span_index[i] = total;
+        total += glyph_spans(font, i, NULL);
+    }
+    if (total > UINT16_MAX) {
+        free(font->span_index);
+        font->span_index = NULL;
+        return false;
+    }
+    font->span_index[font->count] = total;
+
+    font->spans = malloc((total ? total : 1) * sizeof(font_span_t));
+    if (!font->spans) {
+        free(font->span_index);
+        font->span_index = NULL;
+        return false;
+    }
+
+    for (int i = 0; i < font->count; i++) {
+        glyph_spans(font, i, font->spans + font->span_index[i]);
+    }
+
+    return true;
+}
+
+static int glyph_index(const font_t *font, char c)
+{
+    int i = (uint8_t)c - font->first;
+    if (i < 0 || i >= font->count) {
+        i = '?' - font->first;
+        if (i < 0 || i >= font->count) {
+            return -1;
+        }
+    }
+    return i;
+}
+
+static int glyph_advance(const font_t *font, int glyph)
+{
+    return glyph < 0 ? font->max_width : font->widths[glyph];
+}
+
+void font_measure(font_t *font, const char *text, short *width, short *height)
+{
+    int w = 0, line = 0, lines = 1;
+
+    for (; *text; text++) {
+        if (*text == '\n') {
+            lines++;
+            line = 0;
+            continue;
+        }
+        line += glyph_advance(font, glyph_index(font, *text));
+        if (line > w) {
+            w = line;
+        }
+    }
+
+    if (width) {
+        *width = w;
+    }
+    if (height) {
+        *height = lines * font->height;
+    }
+}
+
+short font_draw_string(gbuf_t *g, font_t *font, short x, short y, const char *text, uint32_t color)
+{
+    if (!font_prepare(font)) {
+        return 0;
+    }
+
+    if (g->bytes_per_pixel == 2 && g->endian != BYTE_ORDER) {
+        color = pixel_bswap16(color);
+    }
+
+    int pen = x;
+    int top = y;
+    int right = x;
+
+    for (const char *s = text; *s; s++) {
+        if (*s == '\n') {
+            pen = x;
+            top += font->height;
+            continue;
+        }
+
+        int glyph = glyph_index(font, *s);
+        int advance = glyph_advance(font, glyph);
+
+        /* Skip glyphs entirely outside g */
+        if (glyph >= 0 && pen < g->width && pen + font->max_width > 0 &&
+            top < g->height && top + font->height > 0) {
+            const font_span_t *span = font->spans + font->span_index[glyph];
+            const font_span_t *end = font->spans + font->span_index[glyph + 1];
+
+            for (; span < end; span++) {
+                int sy = top + span->y;
+                int sx = pen + span->x;
+                int sw = span->width;
+                if (sy < 0 || sy >= g->height) {
+                    continue;
+                }
+                if (sx < 0) {
+                    sw += sx;
+                    sx = 0;
+                }
+                if (sx + sw > g->width) {
+                    sw = g->width - sx;
+                }
+                if (sw > 0) {
+                    raster_fill_span(g, sx, sy, sw, color);
+                }
+            }
+        }
+
+        pen += advance;
+        if (pen > right) {
+            right = pen;
+        }
+    }
+
+    rect_t r = { x, y, right - x, top + font->height - y };
+    if (r.x < 0) {
+        r.width += r.x;
+        r.x = 0;
+    }
+    if (r.y < 0) {
+        r.height += r.y;
+        r.y = 0;
+    }
+    if (r.x + r.width > g->width) {
+        r.width = g->width - r.x;
+    }
+    if (r.y + r.height > g->height) {
+        r.height = g->height - r.y;
+    }
+    if (r.width > 0 && r.height > 0) {
+        raster_report_damage(g, r);
+    }
+
+    return pen - x;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "gbuf.h"
+
+/* Bitmap fonts. Each glyph is height rows of (max_width + 7) / 8 bytes, most
+ * significant bit leftmost, with its advance in widths[]. Fonts can be
+ * compiled in by filling out a font_t (leave spans NULL) or loaded from a
+ * file holding "OGF1", height, first, count, max_width, the widths and the
+ * bitmaps.
+ *
+ * On first use glyphs are converted to horizontal runs of set pixels, which
+ * are drawn as spans. A font may have at most 65535 of them, counted over all
+ * glyphs; font_load() refuses larger ones and compiled-in fonts over the
+ * limit draw nothing. */
+
+typedef struct {
+    uint8_t y;
+    uint8_t x;
+    uint8_t width;
+} font_span_t;
+
+typedef struct {
+    uint8_t height;
+    uint8_t first;
+    uint8_t count;
+    uint8_t max_width;
+    const uint8_t *widths;
+    const uint8_t *bitmap;
+
+    /* glyph cache, built on first use */
+    uint16_t *span_index;
+    font_span_t *spans;
+} font_t;
+
+/* NULL if the file can't be read, is not an OGF1 font or has too many spans */
+font_t *font_load(const char *path);
+/* Only for fonts returned by font_load */
+void font_free(font_t *font);
+
+/* Size of the text in pixels; '\n' starts a new line. */
+void font_measure(font_t *font, const char *text, short *width, short *height);
+
+/* Draw text with its top left corner at x, y, clipped to g. Color is a native
+ * value as for raster_fill_rect. Returns the width of the last line. */
+short font_draw_string(gbuf_t *g, font_t *font, short x, short y, const char *text, uint32_t color);
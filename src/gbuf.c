@@ -1,22 +1,74 @@
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "gbuf.h"
+#include "platform.h"
 
 
-gbuf_t *gbuf_new(uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian)
+/* Pixels follow the header, and indexed buffers carry their palette after
+ * the pixel data. */
+size_t gbuf_size(uint16_t width, uint16_t height, uint16_t bytes_per_pixel)
 {
-    gbuf_t *g = malloc(sizeof(gbuf_t) + width * height * bytes_per_pixel);
-    if (!g) abort();
+    size_t size = sizeof(gbuf_t) + width * height * bytes_per_pixel;
+    if (bytes_per_pixel == 1) {
+        size = (size + 1) & ~1;
+        size += GBUF_PALETTE_SIZE * sizeof(uint16_t);
+    }
+    return size;
+}
+
+gbuf_t *gbuf_setup(void *mem, uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian)
+{
+    gbuf_t *g = mem;
 
     g->width = width;
     g->height = height;
     g->bytes_per_pixel = bytes_per_pixel;
     g->endian = endian;
+    g->stride = width * bytes_per_pixel;
+    g->palette = NULL;
+    g->data = (uint8_t *)(g + 1);
+
+    if (bytes_per_pixel == 1) {
+        size_t offset = (width * height + 1) & ~1;
+        g->palette = (uint16_t *)(g->data + offset);
+        memset(g->palette, 0, GBUF_PALETTE_SIZE * sizeof(uint16_t));
+    }
 
     return g;
 }
 
+gbuf_t *gbuf_new(uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian)
+{
+    gbuf_t *g = malloc(gbuf_size(width, height, bytes_per_pixel));
+    if (!g) abort();
+
+    return gbuf_setup(g, width, height, bytes_per_pixel, endian);
+}
+
+gbuf_t *gbuf_new_caps(uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian, uint32_t caps)
+{
+    gbuf_t *g = heap_caps_malloc(gbuf_size(width, height, bytes_per_pixel), caps);
+    if (!g) return NULL;
+
+    return gbuf_setup(g, width, height, bytes_per_pixel, endian);
+}
+
 void gbuf_free(gbuf_t *g)
 {
     free(g);
 }
+
+gbuf_t gbuf_view(gbuf_t *parent, rect_t r)
+{
+    assert(r.x >= 0 && r.y >= 0 && r.width >= 0 && r.height >= 0);
+    assert(r.x + r.width <= parent->width && r.y + r.height <= parent->height);
+
+    gbuf_t view = *parent;
+    view.width = r.width;
+    view.height = r.height;
+    view.data = parent->data + r.y * parent->stride + r.x * parent->bytes_per_pixel;
+
+    return view;
+}
@@ -1,17 +1,47 @@
 #pragma once
 
+#ifdef ESP_PLATFORM
 #include <machine/endian.h>
+#else
+#include <endian.h>
+#endif
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "rect.h"
+
+#define GBUF_PALETTE_SIZE (256)
 
 typedef struct {
     uint16_t width;
     uint16_t height;
-    uint16_t bytes_per_pixel; /* 2:RGB16, 3:RGB, 4:RGBA */  
+    uint16_t bytes_per_pixel; /* 1:indexed, 2:RGB16, 3:RGB, 4:RGBA */  
     uint16_t endian;
-    uint8_t data[];
+    uint16_t stride; /* bytes from one row to the next */
+    uint16_t *palette; /* indexed only: RGB16 entries in the gbuf's endian */
+    uint8_t *data;
 } gbuf_t;
 
 
 gbuf_t *gbuf_new(uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian);
+/* Like gbuf_new, but allocates with heap_caps_malloc and returns NULL on
+ * failure so the caller can fall back to other memory. */
+gbuf_t *gbuf_new_caps(uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian, uint32_t caps);
 void gbuf_free(gbuf_t *g);
+
+/* For allocators placing gbufs in their own memory: the bytes a gbuf needs,
+ * and setting one up in mem, which must be aligned for a pointer. */
+size_t gbuf_size(uint16_t width, uint16_t height, uint16_t bytes_per_pixel);
+gbuf_t *gbuf_setup(void *mem, uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian);
+
+/* A gbuf aliasing rect r of parent, sharing its pixels and palette. Views
+ * are plain values: they own nothing, are not freed and must not outlive
+ * parent. */
+gbuf_t gbuf_view(gbuf_t *parent, rect_t r);
+
+/* Rows follow each other without padding */
+static inline bool gbuf_packed(const gbuf_t *g)
+{
+    return g->stride == g->width * g->bytes_per_pixel;
+}
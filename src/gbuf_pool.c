@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbuf_pool.h"
+#include "platform.h"
+
+/* Classes run 64, 80, 96, 112, 128, 160, ... bytes: four per power of two,
+ * so rounding wastes at most 20% of a block. 72 classes reach 16 MB. */
+#define POOL_MIN_CLASS (64)
+#define POOL_CLASSES (72)
+#define POOL_ALIGN (8)
+
+/* Every block starts with a header, the gbuf follows */
+typedef struct {
+    uint32_t size; /* block bytes, the class size in a pool */
+    uint32_t requested;
+} pool_block_t;
+
+/* Released blocks are linked through the gbuf space */
+typedef struct pool_free {
+    struct pool_free *next;
+} pool_free_t;
+
+struct gbuf_pool {
+    uint8_t *base;
+    size_t size;
+    size_t top;
+    bool arena;
+    pool_free_t *free_list[POOL_CLASSES];
+
+    size_t in_use;
+    size_t requested;
+    size_t high_water;
+    size_t free_listed;
+    uint32_t live;
+    uint32_t failures;
+};
+
+_Static_assert(sizeof(pool_block_t) % POOL_ALIGN == 0, "gbufs must stay aligned");
+
+/* Smallest class holding size bytes, or -1 if there is none. Above 64 bytes,
+ * the top three bits of size - 1 pick the quarter of its power of two. */
+static int size_class(size_t size, size_t *class_size)
+{
+    if (size <= POOL_MIN_CLASS) {
+        *class_size = POOL_MIN_CLASS;
+        return 0;
+    }
+
+    unsigned long s = size - 1;
+    int e = sizeof(long) * 8 - 1 - __builtin_clzl(s);
+    int m = s >> (e - 2);
+    int cls = 4 * (e - 6) + m - 3;
+
+    if (cls >= POOL_CLASSES) {
+        return -1;
+    }
+
+    *class_size = (size_t)(m + 1) << (e - 2);
+    return cls;
+}
+
+gbuf_pool_t *gbuf_pool_new(size_t size, uint32_t caps, bool arena)
+{
+    gbuf_pool_t *pool = calloc(1, sizeof(gbuf_pool_t));
+    if (!pool) return NULL;
+
+    pool->base = heap_caps_malloc(size, caps);
+    if (!pool->base) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->size = size;
+    pool->arena = arena;
+
+    return pool;
+}
+
+void gbuf_pool_free(gbuf_pool_t *pool)
+{
+    if (pool) {
+        free(pool->base);
+        free(pool);
+    }
+}
+
+static pool_block_t *pop_free(gbuf_pool_t *pool, int cls)
+{
+    pool_free_t *f = pool->free_list[cls];
+    pool_block_t *block = (pool_block_t *)f - 1;
+
+    pool->free_list[cls] = f->next;
+    pool->free_listed -= block->size;
+    return block;
+}
+
+gbuf_t *gbuf_pool_alloc(gbuf_pool_t *pool, uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian)
+{
+    size_t requested = sizeof(pool_block_t) + gbuf_size(width, height, bytes_per_pixel);
+    size_t size = (requested + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1);
+    pool_block_t *block = NULL;
+
+    int cls = -1;
+    if (!pool->arena) {
+        cls = size_class(requested, &size);
+    }
+
+    if (cls >= 0 && pool->free_list[cls]) {
+        block = pop_free(pool, cls);
+    } else if ((cls >= 0 || pool->arena) && size <= pool->size - pool->top) {
+        block = (pool_block_t *)(pool->base + pool->top);
+        block->size = size;
+        pool->top += size;
+    } else if (cls >= 0) {
+        // The unused end is too small: use the smallest larger free block
+        // whole. It keeps its size, and goes back to its own class.
+        for (int c = cls + 1; c < POOL_CLASSES && !block; c++) {
+            if (pool->free_list[c]) {
+                block = pop_free(pool, c);
+            }
+        }
+    }
+
+    if (!block) {
+        pool->failures++;
+        return NULL;
+    }
+
+    block->requested = requested;
+
+    pool->in_use += block->size;
+    pool->requested += requested;
+    pool->live++;
+    if (pool->in_use > pool->high_water) {
+        pool->high_water = pool->in_use;
+    }
+
+    return gbuf_setup(block + 1, width, height, bytes_per_pixel, endian);
+}
+
+void gbuf_pool_release(gbuf_pool_t *pool, gbuf_t *g)
+{
+    if (!g || pool->arena) {
+        return;
+    }
+
+    pool_block_t *block = (pool_block_t *)g - 1;
+    assert((uint8_t *)block >= pool->base && (uint8_t *)block < pool->base + pool->top);
+
+    // Blocks of a pool are always a class size
+    size_t size = 0;
+    int cls = size_class(block->size, &size);
+    assert(cls >= 0 && size == block->size);
+
+    pool->in_use -= block->size;
+    pool->requested -= block->requested;
+    pool->live--;
+
+    pool_free_t *f = (pool_free_t *)g;
+    f->next = pool->free_list[cls];
+    pool->free_list[cls] = f;
+    pool->free_listed += size;
+}
+
+void gbuf_pool_reset(gbuf_pool_t *pool)
+{
+    memset(pool->free_list, 0, sizeof(pool->free_list));
+    pool->top = 0;
+    pool->in_use = 0;
+    pool->requested = 0;
+    pool->free_listed = 0;
+    pool->live = 0;
+}
+
+void gbuf_pool_get_stats(const gbuf_pool_t *pool, gbuf_pool_stats_t *stats)
+{
+    size_t free_bytes = pool->free_listed + (pool->size - pool->top);
+
+    stats->size = pool->size;
+    stats->in_use = pool->in_use;
+    stats->requested = pool->requested;
+    stats->high_water = pool->high_water;
+    stats->top = pool->top;
+    stats->free_listed = pool->free_listed;
+    stats->live = pool->live;
+    stats->failures = pool->failures;
+    stats->fragmentation = free_bytes ? (float)pool->free_listed / free_bytes : 0.0f;
+}
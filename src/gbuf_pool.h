@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gbuf.h"
+
+/* Pools of gbufs carved from one block allocated up front, for transient
+ * surfaces (sprites, text boxes, scratch buffers) that would otherwise churn
+ * and fragment the heap.
+ *
+ * A pool serves each size class from its own free list: requests are rounded
+ * up to a class a quarter power of two apart, released gbufs go back to the
+ * list of their class and new ones are cut from the unused end of the block.
+ * Once that end is too small, a request takes a free gbuf of the smallest
+ * larger class that has one, whole; blocks are not split or merged.
+ *
+ * An arena is a pool that packs gbufs without rounding and releases them all
+ * at once with gbuf_pool_reset(), for surfaces that live as long as a screen.
+ * gbuf_pool_release() does nothing on an arena.
+ *
+ * Pools are not thread safe. Their gbufs must not be passed to gbuf_free(). */
+
+typedef struct gbuf_pool gbuf_pool_t;
+
+typedef struct {
+    size_t size; /* bytes in the block */
+    size_t in_use; /* bytes of live gbufs, including rounding */
+    size_t requested; /* bytes live gbufs asked for */
+    size_t high_water; /* peak of in_use */
+    size_t top; /* bytes cut from the block so far */
+    size_t free_listed; /* bytes waiting in free lists */
+    uint32_t live; /* gbufs allocated and not released */
+    uint32_t failures; /* allocations the pool could not serve */
+    /* Share of the free memory held in free lists, where only requests of
+     * the same or a smaller class can use it. 0 when all of it is at the
+     * unused end. */
+    float fragmentation;
+} gbuf_pool_stats_t;
+
+/* NULL if the block can't be allocated with caps */
+gbuf_pool_t *gbuf_pool_new(size_t size, uint32_t caps, bool arena);
+void gbuf_pool_free(gbuf_pool_t *pool);
+
+/* NULL when the pool is exhausted, so the caller can fall back to gbuf_new() */
+gbuf_t *gbuf_pool_alloc(gbuf_pool_t *pool, uint16_t width, uint16_t height, uint16_t bytes_per_pixel, uint16_t endian);
+void gbuf_pool_release(gbuf_pool_t *pool, gbuf_t *g);
+/* Release every gbuf of the pool at once */
+void gbuf_pool_reset(gbuf_pool_t *pool);
+
+void gbuf_pool_get_stats(const gbuf_pool_t *pool, gbuf_pool_stats_t *stats);
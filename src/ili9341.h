@@ -0,0 +1,28 @@
+#pragma once
+
+/* ILI9341 commands and register bits shared by the display backends */
+
+#define TFT_CMD_SWRESET	0x01
+#define TFT_CMD_SLEEP 0x10
+#define TFT_CMD_SLEEP_OUT 0x11
+#define TFT_CMD_DISPLAY_OFF 0x28
+#define TFT_CMD_DISPLAY_ON 0x29
+#define TFT_CMD_CASET 0x2A
+#define TFT_CMD_PASET 0x2B
+#define TFT_CMD_RAMWR 0x2C
+#define TFT_CMD_VSCRDEF 0x33
+#define TFT_CMD_MADCTL 0x36
+#define TFT_CMD_VSCRSADD 0x37
+#define TFT_CMD_RAMWR_CONTINUE 0x3C
+
+/* MADCTL: MV exchanges rows and columns, then MY and MX reverse the page
+ * (320 gate lines) and column (240 sources) address order */
+#define MADCTL_MY  0x80
+#define MADCTL_MX  0x40
+#define MADCTL_MV  0x20
+#define MADCTL_ML  0x10
+#define MADCTL_MH 0x04
+#define TFT_RGB_BGR 0x08
+
+#define TFT_COLUMNS (240)
+#define TFT_PAGES (320)
@@ -0,0 +1,189 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "mixer.h"
+
+#define MIXER_BLOCK_FRAMES (64)
+
+/*
+ Control calls publish a request through a sequence count, odd while the
+ request is being written. The mixer takes a request only when the count is
+ even and unchanged across the copy, otherwise it tries again at the next
+ block, so neither side ever waits for the other.
+*/
+typedef struct {
+    // Written by the controlling task
+    mixer_sample_t request;
+    atomic_uint request_seq;
+    atomic_int volume;
+    atomic_int pan;
+
+    // Published by the mixer: the request whose sample has ended
+    atomic_uint done_seq;
+
+    // Mixer state
+    unsigned int seen_seq;
+    mixer_sample_t sample;
+    uint32_t position;
+} mixer_voice_t;
+
+static mixer_voice_t s_voices[MIXER_VOICES];
+static int32_t s_mix[MIXER_BLOCK_FRAMES * 2];
+
+void mixer_init(void)
+{
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        mixer_voice_t *v = &s_voices[i];
+        memset(&v->sample, 0, sizeof(v->sample));
+        v->seen_seq = atomic_load(&v->request_seq);
+        atomic_store(&v->done_seq, v->seen_seq);
+        atomic_store(&v->volume, MIXER_UNITY);
+        atomic_store(&v->pan, 0);
+    }
+}
+
+static void mixer_request(int voice, const mixer_sample_t *sample)
+{
+    assert(voice >= 0 && voice < MIXER_VOICES);
+    mixer_voice_t *v = &s_voices[voice];
+
+    unsigned int seq = atomic_load_explicit(&v->request_seq, memory_order_relaxed);
+    atomic_store_explicit(&v->request_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if (sample) {
+        v->request = *sample;
+    } else {
+        memset(&v->request, 0, sizeof(v->request));
+    }
+
+    atomic_store_explicit(&v->request_seq, seq + 2, memory_order_release);
+}
+
+void mixer_play(int voice, const mixer_sample_t *sample)
+{
+    assert(sample->loop_end <= sample->frames && sample->loop_start <= sample->loop_end);
+
+    mixer_request(voice, sample);
+}
+
+void mixer_stop(int voice)
+{
+    mixer_request(voice, NULL);
+}
+
+bool mixer_playing(int voice)
+{
+    assert(voice >= 0 && voice < MIXER_VOICES);
+    mixer_voice_t *v = &s_voices[voice];
+
+    // Playing from the request on, until the mixer reports its end
+    return atomic_load(&v->done_seq) != atomic_load(&v->request_seq);
+}
+
+void mixer_set_volume(int voice, int volume)
+{
+    assert(voice >= 0 && voice < MIXER_VOICES);
+    atomic_store_explicit(&s_voices[voice].volume, volume, memory_order_relaxed);
+}
+
+void mixer_set_pan(int voice, int pan)
+{
+    assert(voice >= 0 && voice < MIXER_VOICES);
+    atomic_store_explicit(&s_voices[voice].pan, pan < -128 ? -128 : pan > 128 ? 128 : pan, memory_order_relaxed);
+}
+
+// Take a pending request of v, if one is complete
+static void mixer_take_request(mixer_voice_t *v)
+{
+    unsigned int seq = atomic_load_explicit(&v->request_seq, memory_order_acquire);
+    if (seq == v->seen_seq || (seq & 1)) {
+        return;
+    }
+
+    mixer_sample_t sample = v->request;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&v->request_seq, memory_order_relaxed) != seq) {
+        return;
+    }
+
+    v->seen_seq = seq;
+    v->sample = sample;
+    v->position = 0;
+    if (!sample.data) {
+        atomic_store(&v->done_seq, seq);
+    }
+}
+
+// Add frames of v from its position onto the mix, with Q8 gains
+static void mixer_voice(mixer_voice_t *v, int32_t *mix, int frames, int32_t left, int32_t right)
+{
+    const mixer_sample_t *s = &v->sample;
+
+    while (frames > 0 && s->data) {
+        uint32_t end = s->loop_end ? s->loop_end : s->frames;
+        int n = end - v->position < frames ? end - v->position : frames;
+
+        if (s->stereo) {
+            const int16_t *p = &s->data[v->position * 2];
+            for (int i = 0; i < n; i++) {
+                mix[i * 2] += p[i * 2] * left;
+                mix[i * 2 + 1] += p[i * 2 + 1] * right;
+            }
+        } else {
+            const int16_t *p = &s->data[v->position];
+            for (int i = 0; i < n; i++) {
+                mix[i * 2] += p[i] * left;
+                mix[i * 2 + 1] += p[i] * right;
+            }
+        }
+
+        mix += n * 2;
+        frames -= n;
+        v->position += n;
+
+        if (v->position == end) {
+            if (s->loop_end > s->loop_start) {
+                v->position = s->loop_start;
+            } else {
+                v->sample.data = NULL;
+                atomic_store(&v->done_seq, v->seen_seq);
+            }
+        }
+    }
+}
+
+void mixer_mix(short *buf, int frames)
+{
+    int32_t gains[MIXER_VOICES][2];
+
+    for (int i = 0; i < MIXER_VOICES; i++) {
+        mixer_voice_t *v = &s_voices[i];
+        mixer_take_request(v);
+
+        // Balance: the far side fades out as pan moves away from it
+        int volume = atomic_load_explicit(&v->volume, memory_order_relaxed);
+        int pan = atomic_load_explicit(&v->pan, memory_order_relaxed);
+        gains[i][0] = pan > 0 ? volume * (128 - pan) / 128 : volume;
+        gains[i][1] = pan < 0 ? volume * (128 + pan) / 128 : volume;
+    }
+
+    while (frames > 0) {
+        int n = frames < MIXER_BLOCK_FRAMES ? frames : MIXER_BLOCK_FRAMES;
+
+        memset(s_mix, 0, n * 2 * sizeof(int32_t));
+        for (int i = 0; i < MIXER_VOICES; i++) {
+            mixer_voice(&s_voices[i], s_mix, n, gains[i][0], gains[i][1]);
+        }
+
+        for (int i = 0; i < n * 2; i++) {
+            int32_t sample = buf[i] + (s_mix[i] >> 8);
+            buf[i] = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+        }
+
+        buf += n * 2;
+        frames -= n;
+    }
+}
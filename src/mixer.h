@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Software mixer for music, effects and UI sounds in front of
+ * audio_submit(). Voices play 16-bit PCM samples from memory, each with its
+ * own volume and pan, and mixer_mix() adds them onto a stereo block with
+ * saturation:
+ *
+ *     memset(buf, 0, frames * 2 * sizeof(short));   // or the core's audio
+ *     mixer_mix(buf, frames);
+ *     audio_submit(buf, frames);
+ *
+ * Voices are controlled without locks from any task while another one mixes.
+ * Each voice must be controlled by one task at a time; changes take effect at
+ * the next mixer_mix() call. */
+
+#ifndef MIXER_VOICES
+#define MIXER_VOICES (8)
+#endif
+
+/* Volume of a sample played as is */
+#define MIXER_UNITY (256)
+
+typedef struct {
+    const int16_t *data; /* interleaved when stereo, must outlive playback */
+    uint32_t frames;
+    bool stereo;
+    /* Loop [loop_start, loop_end) once playback reaches loop_end, or play
+     * once when loop_end is 0 */
+    uint32_t loop_start;
+    uint32_t loop_end;
+} mixer_sample_t;
+
+/* Set every voice to MIXER_UNITY volume, centered and silent */
+void mixer_init(void);
+
+/* Start sample on voice from its first frame, replacing what it played */
+void mixer_play(int voice, const mixer_sample_t *sample);
+void mixer_stop(int voice);
+/* False once a one-shot sample has ended or the voice was stopped */
+bool mixer_playing(int voice);
+
+/* 0 to MIXER_UNITY and beyond, the mix saturates */
+void mixer_set_volume(int voice, int volume);
+/* -128 for left only, 0 for center, 128 for right only */
+void mixer_set_pan(int voice, int pan);
+
+/* Add every playing voice onto frames stereo frames of buf */
+void mixer_mix(short *buf, int frames);
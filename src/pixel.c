@@ -0,0 +1,186 @@
+#ifdef ESP_PLATFORM
+#include <machine/endian.h>
+#else
+#include <endian.h>
+#endif
+
+#include "pixel.h"
+
+
+void pixel_expand_indexed(uint16_t *dst, const uint8_t *src, const uint16_t *palette, int count)
+{
+    /* Four pixels per iteration; the lookups are independent so the loads
+     * can overlap. */
+    while (count >= 4) {
+        uint16_t a = palette[src[0]];
+        uint16_t b = palette[src[1]];
+        uint16_t c = palette[src[2]];
+        uint16_t d = palette[src[3]];
+        dst[0] = a;
+        dst[1] = b;
+        dst[2] = c;
+        dst[3] = d;
+        src += 4;
+        dst += 4;
+        count -= 4;
+    }
+
+    while (count--) {
+        *dst++ = palette[*src++];
+    }
+}
+
+void pixel_swap16(uint16_t *dst, const uint16_t *src, int count)
+{
+    /* Get both pointers word aligned if they can be, then swap two pixels
+     * per 32-bit word. */
+    if (((uintptr_t)dst & 3) == ((uintptr_t)src & 3)) {
+        if (((uintptr_t)dst & 3) && count > 0) {
+            uint16_t v = *src++;
+            *dst++ = (v << 8) | (v >> 8);
+            count--;
+        }
+
+        uint32_t *d = (uint32_t *)dst;
+        const uint32_t *s = (const uint32_t *)src;
+        while (count >= 4) {
+            uint32_t a = s[0];
+            uint32_t b = s[1];
+            d[0] = ((a & 0x00ff00ff) << 8) | ((a >> 8) & 0x00ff00ff);
+            d[1] = ((b & 0x00ff00ff) << 8) | ((b >> 8) & 0x00ff00ff);
+            s += 2;
+            d += 2;
+            count -= 4;
+        }
+        dst = (uint16_t *)d;
+        src = (const uint16_t *)s;
+    }
+
+    while (count--) {
+        uint16_t v = *src++;
+        *dst++ = (v << 8) | (v >> 8);
+    }
+}
+
+static inline uint16_t pack565(int r, int g, int b)
+{
+    uint16_t v = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) | (b >> 3);
+    return (v << 8) | (v >> 8);
+}
+
+static void to_rgb565(uint16_t *dst, const uint8_t *src, int count, int stride)
+{
+    while (count >= 4) {
+        uint16_t a = pack565(src[0], src[1], src[2]);
+        uint16_t b = pack565(src[stride], src[stride + 1], src[stride + 2]);
+        uint16_t c = pack565(src[2 * stride], src[2 * stride + 1], src[2 * stride + 2]);
+        uint16_t d = pack565(src[3 * stride], src[3 * stride + 1], src[3 * stride + 2]);
+        dst[0] = a;
+        dst[1] = b;
+        dst[2] = c;
+        dst[3] = d;
+        src += 4 * stride;
+        dst += 4;
+        count -= 4;
+    }
+
+    while (count--) {
+        *dst++ = pack565(src[0], src[1], src[2]);
+        src += stride;
+    }
+}
+
+#if BYTE_ORDER == LITTLE_ENDIAN
+/* Pack the R, G and B bytes found at bit offsets 0, 8 and 16 of w. */
+static inline uint16_t pack565_word(uint32_t w)
+{
+    uint16_t v = ((w & 0xf8) << 8) | ((w & 0xfc00) >> 5) | ((w & 0xf80000) >> 19);
+    return (v << 8) | (v >> 8);
+}
+#endif
+
+void pixel_rgb888_to_rgb565(uint16_t *dst, const uint8_t *src, int count)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    if (((uintptr_t)src & 3) == 0) {
+        /* Four pixels from three aligned words:
+         * R0 G0 B0 R1 | G1 B1 R2 G2 | B2 R3 G3 B3 */
+        const uint32_t *s = (const uint32_t *)src;
+        while (count >= 4) {
+            uint32_t w0 = s[0];
+            uint32_t w1 = s[1];
+            uint32_t w2 = s[2];
+            dst[0] = pack565_word(w0);
+            dst[1] = pack565_word((w0 >> 24) | (w1 << 8));
+            dst[2] = pack565_word((w1 >> 16) | (w2 << 16));
+            dst[3] = pack565_word(w2 >> 8);
+            s += 3;
+            dst += 4;
+            count -= 4;
+        }
+        src = (const uint8_t *)s;
+    }
+#endif
+
+    to_rgb565(dst, src, count, 3);
+}
+
+void pixel_rgba8888_to_rgb565(uint16_t *dst, const uint8_t *src, int count)
+{
+#if BYTE_ORDER == LITTLE_ENDIAN
+    if (((uintptr_t)src & 3) == 0) {
+        const uint32_t *s = (const uint32_t *)src;
+        while (count >= 2) {
+            uint32_t a = s[0];
+            uint32_t b = s[1];
+            dst[0] = pack565_word(a);
+            dst[1] = pack565_word(b);
+            s += 2;
+            dst += 2;
+            count -= 2;
+        }
+        src = (const uint8_t *)s;
+    }
+#endif
+
+    to_rgb565(dst, src, count, 4);
+}
+
+/* 4x4 Bayer matrix, thresholds 0-15 */
+static const uint8_t bayer4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+static inline int sat255(int v)
+{
+    return v > 255 ? 255 : v;
+}
+
+static void to_rgb565_dither(uint16_t *dst, const uint8_t *src, int count, int x, int y, int stride)
+{
+    const uint8_t *row = bayer4[y & 3];
+
+    for (int i = 0; i < count; i++) {
+        /* Scale the threshold to the step of each channel: 8 for the five
+         * bit red and blue, 4 for the six bit green. */
+        int t = row[(x + i) & 3];
+        int r = sat255(src[0] + (t >> 1));
+        int g = sat255(src[1] + (t >> 2));
+        int b = sat255(src[2] + (t >> 1));
+        dst[i] = pack565(r, g, b);
+        src += stride;
+    }
+}
+
+void pixel_rgb888_to_rgb565_dither(uint16_t *dst, const uint8_t *src, int count, int x, int y)
+{
+    to_rgb565_dither(dst, src, count, x, y, 3);
+}
+
+void pixel_rgba8888_to_rgb565_dither(uint16_t *dst, const uint8_t *src, int count, int x, int y)
+{
+    to_rgb565_dither(dst, src, count, x, y, 4);
+}
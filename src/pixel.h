@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Pixel format conversion kernels. Destinations are RGB565 in panel (big
+ * endian) byte order. RGB888 and RGBA8888 sources hold their components in
+ * R, G, B(, A) memory order; alpha is ignored.
+ *
+ * The _dither variants add a 4x4 ordered dither before dropping the low
+ * bits; x and y are the position of the first pixel, which anchors the
+ * pattern. */
+
+static inline uint16_t pixel_bswap16(uint16_t v)
+{
+    return (v << 8) | (v >> 8);
+}
+
+/* pixel_bswap16 on both half words of a pixel pair */
+static inline uint32_t pixel_bswap16x2(uint32_t v)
+{
+    return ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+}
+
+/* RGB565 with green moved to the upper half word, leaving room to multiply
+ * all three channels by a 5-bit weight (0-32) at once. */
+static inline uint32_t pixel_expand565(uint16_t c)
+{
+    return (c | ((uint32_t)c << 16)) & 0x07E0F81F;
+}
+
+static inline uint16_t pixel_pack565(uint32_t x)
+{
+    x &= 0x07E0F81F;
+    return x | (x >> 16);
+}
+
+static inline uint32_t pixel_lerp_expanded(uint32_t a, uint32_t b, int weight)
+{
+    return ((a * (32 - weight) + b * weight) >> 5) & 0x07E0F81F;
+}
+
+void pixel_expand_indexed(uint16_t *dst, const uint8_t *src, const uint16_t *palette, int count);
+void pixel_swap16(uint16_t *dst, const uint16_t *src, int count);
+void pixel_rgb888_to_rgb565(uint16_t *dst, const uint8_t *src, int count);
+void pixel_rgba8888_to_rgb565(uint16_t *dst, const uint8_t *src, int count);
+void pixel_rgb888_to_rgb565_dither(uint16_t *dst, const uint8_t *src, int count, int x, int y);
+void pixel_rgba8888_to_rgb565_dither(uint16_t *dst, const uint8_t *src, int count, int x, int y);
@@ -0,0 +1,50 @@
+#pragma once
+
+/* The few ESP-IDF services the graphics code uses outside of FreeRTOS and
+ * the drivers, with plain C fallbacks so it also builds on a host (see
+ * test/). */
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "soc/soc_memory_layout.h"
+#include "xtensa/hal.h"
+#else
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_8BIT (1 << 2)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return calloc(n, size);
+}
+
+static inline bool esp_ptr_dma_capable(const void *p)
+{
+    return true;
+}
+
+static inline int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Nanoseconds stand in for CPU cycles */
+static inline uint32_t xthal_get_ccount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec);
+}
+#endif
@@ -0,0 +1,386 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pixel.h"
+#include "raster.h"
+
+
+static raster_damage_cb_t s_damage_cb = NULL;
+static void *s_damage_arg = NULL;
+
+void raster_register_damage_callback(raster_damage_cb_t cb, void *arg)
+{
+    s_damage_cb = cb;
+    s_damage_arg = arg;
+}
+
+void raster_report_damage(const gbuf_t *g, rect_t r)
+{
+    if (s_damage_cb) {
+        s_damage_cb(g, r, s_damage_arg);
+    }
+}
+
+/* Clip r to g, returning false if nothing is left. */
+static bool clip_rect(const gbuf_t *g, rect_t *r)
+{
+    if (r->x < 0) {
+        r->width += r->x;
+        r->x = 0;
+    }
+    if (r->y < 0) {
+        r->height += r->y;
+        r->y = 0;
+    }
+    if (r->x + r->width > g->width) {
+        r->width = g->width - r->x;
+    }
+    if (r->y + r->height > g->height) {
+        r->height = g->height - r->y;
+    }
+    return r->width > 0 && r->height > 0;
+}
+
+/* Clip a blit of src_rect to at in dst, against both buffers. */
+static bool clip_blit(const gbuf_t *dst, point_t *at, const gbuf_t *src, rect_t *src_rect)
+{
+    rect_t s = *src_rect;
+    if (!clip_rect(src, &s)) {
+        return false;
+    }
+
+    /* Whatever was clipped off the source moves the destination along */
+    at->x += s.x - src_rect->x;
+    at->y += s.y - src_rect->y;
+    *src_rect = s;
+
+    rect_t d = { at->x, at->y, src_rect->width, src_rect->height };
+    if (!clip_rect(dst, &d)) {
+        return false;
+    }
+
+    src_rect->x += d.x - at->x;
+    src_rect->y += d.y - at->y;
+    src_rect->width = d.width;
+    src_rect->height = d.height;
+    at->x = d.x;
+    at->y = d.y;
+    return true;
+}
+
+static inline uint8_t *pixel_at(const gbuf_t *g, int x, int y)
+{
+    return (uint8_t *)g->data + y * g->stride + x * g->bytes_per_pixel;
+}
+
+static inline bool native_endian(const gbuf_t *g)
+{
+    return g->endian == BYTE_ORDER;
+}
+
+/* Color as it is stored in g */
+static uint32_t stored_color(const gbuf_t *g, uint32_t color)
+{
+    if (g->bytes_per_pixel == 2 && !native_endian(g)) {
+        return pixel_bswap16(color);
+    }
+    return color;
+}
+
+static void fill_span16(uint16_t *p, int count, uint16_t c)
+{
+    if (((uintptr_t)p & 3) && count > 0) {
+        *p++ = c;
+        count--;
+    }
+
+    uint32_t *w = (uint32_t *)p;
+    uint32_t cc = c | ((uint32_t)c << 16);
+    while (count >= 8) {
+        w[0] = cc;
+        w[1] = cc;
+        w[2] = cc;
+        w[3] = cc;
+        w += 4;
+        count -= 8;
+    }
+    while (count >= 2) {
+        *w++ = cc;
+        count -= 2;
+    }
+
+    p = (uint16_t *)w;
+    if (count) {
+        *p = c;
+    }
+}
+
+static void fill_span(const gbuf_t *g, uint8_t *p, int count, uint32_t c)
+{
+    switch (g->bytes_per_pixel) {
+        case 1:
+            memset(p, c, count);
+            break;
+
+        case 2:
+            fill_span16((uint16_t *)p, count, c);
+            break;
+
+        default: {
+            /* Components in R, G, B(, A) memory order */
+            int bpp = g->bytes_per_pixel;
+            uint8_t px[4] = { c >> 16, c >> 8, c, 0 };
+            if (bpp == 4) {
+                px[0] = c >> 24;
+                px[1] = c >> 16;
+                px[2] = c >> 8;
+                px[3] = c;
+            }
+            for (int i = 0; i < count; i++) {
+                memcpy(p, px, bpp);
+                p += bpp;
+            }
+            break;
+        }
+    }
+}
+
+void raster_fill_span(gbuf_t *g, short x, short y, short width, uint32_t stored)
+{
+    fill_span(g, pixel_at(g, x, y), width, stored);
+}
+
+void raster_fill_rect(gbuf_t *g, rect_t r, uint32_t color)
+{
+    if (!clip_rect(g, &r)) {
+        return;
+    }
+
+    uint32_t c = stored_color(g, color);
+
+    if (r.width == g->width && gbuf_packed(g)) {
+        /* Whole rows are contiguous */
+        fill_span(g, pixel_at(g, 0, r.y), r.width * r.height, c);
+    } else {
+        for (int y = r.y; y < r.y + r.height; y++) {
+            fill_span(g, pixel_at(g, r.x, y), r.width, c);
+        }
+    }
+
+    raster_report_damage(g, r);
+}
+
+void raster_fill_pattern(gbuf_t *g, rect_t r, const gbuf_t *pattern)
+{
+    assert(pattern->bytes_per_pixel == g->bytes_per_pixel);
+
+    if (!clip_rect(g, &r)) {
+        return;
+    }
+
+    /* The pattern is anchored at the origin of g */
+    int bpp = g->bytes_per_pixel;
+    for (int y = r.y; y < r.y + r.height; y++) {
+        uint8_t *p = pixel_at(g, r.x, y);
+        int px = r.x % pattern->width;
+        int remaining = r.width;
+
+        while (remaining > 0) {
+            int n = pattern->width - px;
+            n = n < remaining ? n : remaining;
+            memcpy(p, pixel_at(pattern, px, y % pattern->height), n * bpp);
+            p += n * bpp;
+            remaining -= n;
+            px = 0;
+        }
+    }
+
+    raster_report_damage(g, r);
+}
+
+void raster_hline(gbuf_t *g, short x, short y, short width, uint32_t color)
+{
+    rect_t r = { x, y, width, 1 };
+    raster_fill_rect(g, r, color);
+}
+
+void raster_vline(gbuf_t *g, short x, short y, short height, uint32_t color)
+{
+    rect_t r = { x, y, 1, height };
+    if (!clip_rect(g, &r)) {
+        return;
+    }
+
+    uint32_t c = stored_color(g, color);
+    uint8_t *p = pixel_at(g, r.x, r.y);
+
+    for (int i = 0; i < r.height; i++) {
+        fill_span(g, p, 1, c);
+        p += g->stride;
+    }
+
+    raster_report_damage(g, r);
+}
+
+void raster_blit(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect)
+{
+    assert(src->bytes_per_pixel == dst->bytes_per_pixel);
+    assert(src->bytes_per_pixel != 2 || src->endian == dst->endian);
+
+    if (!clip_blit(dst, &at, src, &src_rect)) {
+        return;
+    }
+
+    int bpp = dst->bytes_per_pixel;
+    if (src_rect.width == src->width && src_rect.width == dst->width && gbuf_packed(src) && gbuf_packed(dst)) {
+        memmove(pixel_at(dst, at.x, at.y), pixel_at(src, src_rect.x, src_rect.y), src_rect.width * src_rect.height * bpp);
+    } else if (pixel_at(dst, at.x, at.y) > pixel_at(src, src_rect.x, src_rect.y)) {
+        /* May overlap a copy downwards (views of one buffer too), go bottom up */
+        for (int y = src_rect.height - 1; y >= 0; y--) {
+            memmove(pixel_at(dst, at.x, at.y + y), pixel_at(src, src_rect.x, src_rect.y + y), src_rect.width * bpp);
+        }
+    } else {
+        for (int y = 0; y < src_rect.height; y++) {
+            memmove(pixel_at(dst, at.x, at.y + y), pixel_at(src, src_rect.x, src_rect.y + y), src_rect.width * bpp);
+        }
+    }
+
+    rect_t r = { at.x, at.y, src_rect.width, src_rect.height };
+    raster_report_damage(dst, r);
+}
+
+void raster_blit_key(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect, uint32_t key)
+{
+    assert(src->bytes_per_pixel == dst->bytes_per_pixel);
+    assert(src->bytes_per_pixel <= 2);
+    assert(src->bytes_per_pixel != 2 || src->endian == dst->endian);
+
+    if (!clip_blit(dst, &at, src, &src_rect)) {
+        return;
+    }
+
+    uint32_t k = stored_color(src, key);
+
+    for (int y = 0; y < src_rect.height; y++) {
+        if (src->bytes_per_pixel == 1) {
+            const uint8_t *s = pixel_at(src, src_rect.x, src_rect.y + y);
+            uint8_t *d = pixel_at(dst, at.x, at.y + y);
+            for (int x = 0; x < src_rect.width; x++) {
+                if (s[x] != k) {
+                    d[x] = s[x];
+                }
+            }
+        } else {
+            const uint16_t *s = (const uint16_t *)pixel_at(src, src_rect.x, src_rect.y + y);
+            uint16_t *d = (uint16_t *)pixel_at(dst, at.x, at.y + y);
+            int x = 0;
+            /* Runs of opaque pixels are copied as spans */
+            while (x < src_rect.width) {
+                while (x < src_rect.width && s[x] == k) {
+                    x++;
+                }
+                int start = x;
+                while (x < src_rect.width && s[x] != k) {
+                    x++;
+                }
+                if (x > start) {
+                    memcpy(d + start, s + start, (x - start) * sizeof(uint16_t));
+                }
+            }
+        }
+    }
+
+    rect_t r = { at.x, at.y, src_rect.width, src_rect.height };
+    raster_report_damage(dst, r);
+}
+
+/* Average of two pairs of native RGB565 pixels, without carries crossing
+ * channels. */
+static inline uint32_t average565x2(uint32_t a, uint32_t b)
+{
+    return (a & b) + (((a ^ b) & 0xF7DEF7DE) >> 1);
+}
+
+void raster_blend_half(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect)
+{
+    assert(src->bytes_per_pixel == 2 && dst->bytes_per_pixel == 2);
+    assert(src->endian == dst->endian);
+
+    if (!clip_blit(dst, &at, src, &src_rect)) {
+        return;
+    }
+
+    bool swap = !native_endian(dst);
+
+    for (int y = 0; y < src_rect.height; y++) {
+        const uint16_t *s = (const uint16_t *)pixel_at(src, src_rect.x, src_rect.y + y);
+        uint16_t *d = (uint16_t *)pixel_at(dst, at.x, at.y + y);
+        int x = 0;
+
+        if (((uintptr_t)s & 3) == ((uintptr_t)d & 3)) {
+            if ((uintptr_t)d & 3) {
+                d[0] = swap ? pixel_bswap16(average565x2(pixel_bswap16(d[0]), pixel_bswap16(s[0])))
+                            : average565x2(d[0], s[0]);
+                x = 1;
+            }
+            if (swap) {
+                /* The green carry runs across the byte lanes the other way,
+                 * so average in native order and swap both pixels back. */
+                for (; x + 2 <= src_rect.width; x += 2) {
+                    uint32_t a = pixel_bswap16x2(*(uint32_t *)&d[x]);
+                    uint32_t b = pixel_bswap16x2(*(const uint32_t *)&s[x]);
+                    *(uint32_t *)&d[x] = pixel_bswap16x2(average565x2(a, b));
+                }
+            } else {
+                for (; x + 2 <= src_rect.width; x += 2) {
+                    *(uint32_t *)&d[x] = average565x2(*(uint32_t *)&d[x], *(const uint32_t *)&s[x]);
+                }
+            }
+        }
+
+        for (; x < src_rect.width; x++) {
+            if (swap) {
+                d[x] = pixel_bswap16(average565x2(pixel_bswap16(d[x]), pixel_bswap16(s[x])));
+            } else {
+                d[x] = average565x2(d[x], s[x]);
+            }
+        }
+    }
+
+    rect_t r = { at.x, at.y, src_rect.width, src_rect.height };
+    raster_report_damage(dst, r);
+}
+
+void raster_blend_alpha(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect, uint8_t alpha)
+{
+    assert(src->bytes_per_pixel == 2 && dst->bytes_per_pixel == 2);
+    assert(src->endian == dst->endian);
+
+    if (alpha == 255) {
+        raster_blit(dst, at, src, src_rect);
+        return;
+    }
+
+    if (!clip_blit(dst, &at, src, &src_rect)) {
+        return;
+    }
+
+    bool swap = !native_endian(dst);
+    int weight = (alpha + 4) >> 3; /* 0-32 */
+
+    for (int y = 0; y < src_rect.height; y++) {
+        const uint16_t *s = (const uint16_t *)pixel_at(src, src_rect.x, src_rect.y + y);
+        uint16_t *d = (uint16_t *)pixel_at(dst, at.x, at.y + y);
+
+        for (int x = 0; x < src_rect.width; x++) {
+            uint16_t a = swap ? pixel_bswap16(d[x]) : d[x];
+            uint16_t b = swap ? pixel_bswap16(s[x]) : s[x];
+            uint16_t c = pixel_pack565(pixel_lerp_expanded(pixel_expand565(a), pixel_expand565(b), weight));
+            d[x] = swap ? pixel_bswap16(c) : c;
+        }
+    }
+
+    rect_t r = { at.x, at.y, src_rect.width, src_rect.height };
+    raster_report_damage(dst, r);
+}
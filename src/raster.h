@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "gbuf.h"
+#include "point.h"
+#include "rect.h"
+
+/* 2D drawing on gbufs. Everything is clipped to the destination. Colors are
+ * given as native values: a palette index for indexed gbufs, RGB565 for RGB16
+ * (stored in the gbuf's endian), and 0xRRGGBB / 0xRRGGBBAA for RGB / RGBA.
+ * Blits need source and destination in the same format; blending is RGB16
+ * only. */
+
+typedef void (*raster_damage_cb_t)(const gbuf_t *g, rect_t r, void *arg);
+
+/* Report every rect touched by a primitive, e.g. to display_mark_dirty. */
+void raster_register_damage_callback(raster_damage_cb_t cb, void *arg);
+/* For drawing code outside this module */
+void raster_report_damage(const gbuf_t *g, rect_t r);
+/* Fill width pixels from (x, y) with a color already in g's byte order.
+ * Unclipped and not reported as damage, for callers that do both. */
+void raster_fill_span(gbuf_t *g, short x, short y, short width, uint32_t stored);
+
+void raster_fill_rect(gbuf_t *g, rect_t r, uint32_t color);
+void raster_fill_pattern(gbuf_t *g, rect_t r, const gbuf_t *pattern);
+void raster_hline(gbuf_t *g, short x, short y, short width, uint32_t color);
+void raster_vline(gbuf_t *g, short x, short y, short height, uint32_t color);
+
+void raster_blit(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect);
+void raster_blit_key(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect, uint32_t key);
+void raster_blend_half(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect);
+void raster_blend_alpha(gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect, uint8_t alpha);
@@ -0,0 +1,201 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resampler.h"
+
+#define SINC_TAPS (16)
+/* Coefficient rows per input frame, outputs between rows are interpolated */
+#define SINC_PHASE_BITS (6)
+#define SINC_PHASES (1 << SINC_PHASE_BITS)
+/* Input frames buffered at once, beyond the filter history */
+#define RESAMPLER_BLOCK_FRAMES (64)
+/* Rebuild the filter when the cutoff moves further than this */
+#define RESAMPLER_CUTOFF_SLACK (0.02)
+
+/*
+ Output frames are taken at a position in the buffered input that advances
+ by the ratio, an integer frame index and a 32-bit fraction. Frame index pos
+ is the tap just left of the position: the filter reads
+ buf[pos - taps/2 + 1 .. pos + taps/2], so the buffer keeps taps/2 - 1
+ frames of history before it.
+*/
+struct resampler {
+    resampler_mode_t mode;
+    int taps;
+    uint64_t step; /* input frames per output frame, 32.32 */
+    uint32_t frac;
+    int pos;
+    int len;
+    double cutoff;
+    int16_t (*coeffs)[SINC_TAPS]; /* SINC_PHASES + 1 rows, Q15 */
+    short buf[(SINC_TAPS + RESAMPLER_BLOCK_FRAMES) * 2];
+};
+
+/* Lowpass at cutoff (1 is the input Nyquist), Blackman windowed. Each row
+ * sums to one so DC passes unchanged. */
+static void resampler_build(resampler_t *r, double cutoff)
+{
+    const double half = SINC_TAPS / 2;
+
+    for (int phase = 0; phase <= SINC_PHASES; phase++) {
+        double h[SINC_TAPS];
+        double sum = 0;
+
+        for (int k = 0; k < SINC_TAPS; k++) {
+            double d = (k - half + 1) - (double)phase / SINC_PHASES;
+            double x = M_PI * cutoff * d;
+            double w = 0.42 + 0.5 * cos(M_PI * d / half) + 0.08 * cos(2 * M_PI * d / half);
+            h[k] = (x == 0 ? 1 : sin(x) / x) * (fabs(d) < half ? w : 0);
+            sum += h[k];
+        }
+
+        for (int k = 0; k < SINC_TAPS; k++) {
+            r->coeffs[phase][k] = lround(h[k] / sum * 32767);
+        }
+    }
+
+    r->cutoff = cutoff;
+}
+
+resampler_t *resampler_new(int in_rate, int out_rate, resampler_mode_t mode)
+{
+    resampler_t *r = calloc(1, sizeof(resampler_t));
+    if (!r) return NULL;
+
+    r->mode = mode;
+    r->taps = mode == RESAMPLER_SINC ? SINC_TAPS : 2;
+
+    if (mode == RESAMPLER_SINC) {
+        r->coeffs = malloc((SINC_PHASES + 1) * sizeof(*r->coeffs));
+        if (!r->coeffs) {
+            free(r);
+            return NULL;
+        }
+    }
+
+    resampler_set_ratio(r, (double)in_rate / out_rate);
+    resampler_reset(r);
+
+    return r;
+}
+
+void resampler_free(resampler_t *r)
+{
+    if (r) {
+        free(r->coeffs);
+        free(r);
+    }
+}
+
+void resampler_set_ratio(resampler_t *r, double ratio)
+{
+    r->step = (uint64_t)(ratio * 4294967296.0);
+
+    // Downsampling moves the cutoff below the output Nyquist, with some room
+    // for the transition band. Small rate control steps keep the filter.
+    if (r->mode == RESAMPLER_SINC) {
+        double cutoff = 0.9 * (ratio > 1 ? 1 / ratio : 1);
+        if (fabs(cutoff - r->cutoff) > RESAMPLER_CUTOFF_SLACK * cutoff) {
+            resampler_build(r, cutoff);
+        }
+    }
+}
+
+void resampler_reset(resampler_t *r)
+{
+    // Silence before the first frame
+    r->len = r->taps / 2 - 1;
+    r->pos = r->len;
+    r->frac = 0;
+    memset(r->buf, 0, r->len * 2 * sizeof(short));
+}
+
+static inline short resampler_clamp(int32_t v)
+{
+    return v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+}
+
+// One output frame at the current position
+static void resampler_linear(const resampler_t *r, short *out)
+{
+    const short *p = &r->buf[r->pos * 2];
+    const int32_t f = r->frac >> 17;
+
+    out[0] = p[0] + (((p[2] - p[0]) * f) >> 15);
+    out[1] = p[1] + (((p[3] - p[1]) * f) >> 15);
+}
+
+static void resampler_sinc(const resampler_t *r, short *out)
+{
+    const short *p = &r->buf[(r->pos - SINC_TAPS / 2 + 1) * 2];
+    const int phase = r->frac >> (32 - SINC_PHASE_BITS);
+    const int32_t f = (r->frac >> (32 - SINC_PHASE_BITS - 12)) & 0xfff;
+    const int16_t *c0 = r->coeffs[phase];
+    const int16_t *c1 = r->coeffs[phase + 1];
+    int32_t l0 = 0, r0 = 0, l1 = 0, r1 = 0;
+
+    for (int k = 0; k < SINC_TAPS; k++) {
+        l0 += p[k * 2] * c0[k];
+        r0 += p[k * 2 + 1] * c0[k];
+        l1 += p[k * 2] * c1[k];
+        r1 += p[k * 2 + 1] * c1[k];
+    }
+
+    // Q15 products, then a Q12 step between the two phases
+    l0 >>= 15;
+    r0 >>= 15;
+    l1 >>= 15;
+    r1 >>= 15;
+    out[0] = resampler_clamp(l0 + (((l1 - l0) * f) >> 12));
+    out[1] = resampler_clamp(r0 + (((r1 - r0) * f) >> 12));
+}
+
+int resampler_process(resampler_t *r, const short *in, int *in_frames, short *out, int out_frames)
+{
+    const int history = r->taps / 2 - 1;
+    const int capacity = sizeof(r->buf) / (2 * sizeof(short));
+    int consumed = 0;
+    int produced = 0;
+
+    while (true) {
+        while (produced < out_frames && r->pos + r->taps / 2 < r->len) {
+            if (r->mode == RESAMPLER_SINC) {
+                resampler_sinc(r, &out[produced * 2]);
+            } else {
+                resampler_linear(r, &out[produced * 2]);
+            }
+            produced++;
+
+            uint64_t next = r->frac + r->step;
+            r->frac = next;
+            r->pos += next >> 32;
+        }
+
+        if (produced == out_frames || consumed == *in_frames) {
+            break;
+        }
+
+        // Keep the history the next position needs, and skip input the
+        // position has already passed
+        int drop = r->pos - history;
+        if (drop > r->len) {
+            drop = r->len;
+        }
+        memmove(r->buf, &r->buf[drop * 2], (r->len - drop) * 2 * sizeof(short));
+        r->len -= drop;
+        r->pos -= drop;
+
+        int n = capacity - r->len;
+        if (n > *in_frames - consumed) {
+            n = *in_frames - consumed;
+        }
+        memcpy(&r->buf[r->len * 2], &in[consumed * 2], n * 2 * sizeof(short));
+        r->len += n;
+        consumed += n;
+    }
+
+    *in_frames = consumed;
+    return produced;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Streaming sample rate conversion of stereo 16-bit frames, for sources
+ * whose rate differs from the one given to audio_init():
+ *
+ *     resampler_t *r = resampler_new(31400, 32000, RESAMPLER_SINC);
+ *     ...
+ *     int used = frames;
+ *     int n = resampler_process(r, core_buf, &used, out, out_frames);
+ *     audio_submit(out, n);
+ *
+ * The ratio can change at any time without a click. Producers can use that
+ * to track the I2S clock: nudge it by a few hundred ppm so that audio_fill()
+ * stays near a target level. */
+
+typedef enum {
+    RESAMPLER_LINEAR, /* cheap, some aliasing and treble loss */
+    RESAMPLER_SINC, /* 16-tap windowed sinc, polyphase */
+} resampler_mode_t;
+
+typedef struct resampler resampler_t;
+
+/* NULL on allocation failure */
+resampler_t *resampler_new(int in_rate, int out_rate, resampler_mode_t mode);
+void resampler_free(resampler_t *r);
+
+/* Input frames per output frame, in_rate / out_rate for a fixed conversion */
+void resampler_set_ratio(resampler_t *r, double ratio);
+/* Forget the input history, as at the start of a new stream */
+void resampler_reset(resampler_t *r);
+
+/* Convert up to *in_frames frames of in into at most out_frames frames of
+ * out. Sets *in_frames to the frames consumed and returns the frames
+ * written; input that isn't consumed must be passed again. */
+int resampler_process(resampler_t *r, const short *in, int *in_frames, short *out, int out_frames);
@@ -0,0 +1,163 @@
+/* Stress of gbuf churn: a set of live surfaces replaced at random, through
+ * a gbuf pool, an arena reset per screen, and gbuf_new()/gbuf_free(). Reports
+ * ns per allocate/release pair, and for the pool its high water mark,
+ * fragmentation and failures. For malloc, glibc's heap footprint against the
+ * live bytes stands in for the fragmentation the ESP32 heap would see.
+ *
+ * Usage: bench_gbuf_pool [operations] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "gbuf_pool.h"
+#include "platform.h"
+
+#define LIVE (64)
+#define POOL_SIZE (1024 * 1024)
+#define SCREEN_SURFACES (48)
+
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(void)
+{
+    s_seed = s_seed * 1103515245 + 12345;
+    return s_seed >> 8;
+}
+
+// Mostly sprites and text boxes, now and then a scaled intermediate
+static void random_size(uint16_t *width, uint16_t *height)
+{
+    uint32_t r = next_random();
+    if (r % 16 == 0) {
+        *width = 160;
+        *height = 120;
+    } else {
+        *width = 8 + r % 57;
+        *height = 8 + (r >> 8) % 57;
+    }
+}
+
+#ifdef __GLIBC__
+static size_t live_bytes(gbuf_t **live)
+{
+    size_t bytes = 0;
+    for (int i = 0; i < LIVE; i++) {
+        if (live[i]) {
+            bytes += gbuf_size(live[i]->width, live[i]->height, live[i]->bytes_per_pixel);
+        }
+    }
+    return bytes;
+}
+#endif
+
+static void churn_pool(int ops)
+{
+    gbuf_pool_t *pool = gbuf_pool_new(POOL_SIZE, 0, false);
+    gbuf_t *live[LIVE] = { NULL };
+    uint32_t fallbacks = 0;
+
+    s_seed = 1;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < ops; i++) {
+        int k = next_random() % LIVE;
+        uint16_t w, h;
+        random_size(&w, &h);
+
+        if (live[k]) {
+            gbuf_pool_release(pool, live[k]);
+        }
+        live[k] = gbuf_pool_alloc(pool, w, h, 2, BIG_ENDIAN);
+        fallbacks += !live[k];
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    gbuf_pool_stats_t stats;
+    gbuf_pool_get_stats(pool, &stats);
+    printf("pool    %8.1f ns  high water %zu KB of %zu KB, fragmentation %.2f, %u failures\n",
+        elapsed * 1000.0 / ops, stats.high_water / 1024, stats.size / 1024, stats.fragmentation, fallbacks);
+
+    gbuf_pool_free(pool);
+}
+
+static void churn_malloc(int ops)
+{
+    gbuf_t *live[LIVE] = { NULL };
+
+    s_seed = 1;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < ops; i++) {
+        int k = next_random() % LIVE;
+        uint16_t w, h;
+        random_size(&w, &h);
+
+        if (live[k]) {
+            gbuf_free(live[k]);
+        }
+        live[k] = gbuf_new(w, h, 2, BIG_ENDIAN);
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    printf("malloc  %8.1f ns", elapsed * 1000.0 / ops);
+#ifdef __GLIBC__
+    struct mallinfo2 info = mallinfo2();
+    printf("  heap %zu KB for %zu KB live, %zu KB free in the heap",
+        info.arena / 1024, live_bytes(live) / 1024, info.fordblks / 1024);
+#endif
+    printf("\n");
+
+    for (int i = 0; i < LIVE; i++) {
+        gbuf_free(live[i]);
+    }
+}
+
+// Per-screen surfaces all released together, by resetting an arena or by
+// freeing each one
+static void screens(int ops, bool arena)
+{
+    gbuf_pool_t *pool = arena ? gbuf_pool_new(POOL_SIZE, 0, true) : NULL;
+    gbuf_t *surfaces[SCREEN_SURFACES];
+    const int count = ops / SCREEN_SURFACES;
+
+    s_seed = 2;
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < SCREEN_SURFACES; k++) {
+            uint16_t w, h;
+            random_size(&w, &h);
+            surfaces[k] = arena ? gbuf_pool_alloc(pool, w, h, 2, BIG_ENDIAN) : gbuf_new(w, h, 2, BIG_ENDIAN);
+        }
+        if (arena) {
+            gbuf_pool_reset(pool);
+        } else {
+            for (int k = 0; k < SCREEN_SURFACES; k++) {
+                gbuf_free(surfaces[k]);
+            }
+        }
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    printf("%-7s %8.1f ns per surface, %d screens of %d\n", arena ? "arena" : "malloc",
+        elapsed * 1000.0 / (count * SCREEN_SURFACES), count, SCREEN_SURFACES);
+
+    if (pool) {
+        gbuf_pool_free(pool);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const int ops = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    printf("Random replacement of %d live surfaces, %d operations\n", LIVE, ops);
+    churn_pool(ops);
+    churn_malloc(ops);
+
+    printf("\nPer-screen surfaces\n");
+    screens(ops, true);
+    screens(ops, false);
+
+    return 0;
+}
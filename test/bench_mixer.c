@@ -0,0 +1,75 @@
+/* Cost of mixer_mix() by number of playing voices, for mono and stereo
+ * looping samples: ns per output frame, the added cost of each voice, and
+ * the share of a 32 kHz stream's time that takes. Steps between rows are
+ * noisy on a shared host, the average over all voices is steadier.
+ *
+ * Usage: bench_mixer [seconds per case] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mixer.h"
+#include "platform.h"
+
+#define BLOCK (512)
+#define SAMPLE_FRAMES (22050)
+#define RATE (32000)
+
+static int16_t s_data[SAMPLE_FRAMES * 2];
+static short s_buf[BLOCK * 2];
+
+static double ns_per_frame(int voices, bool stereo, double seconds)
+{
+    const mixer_sample_t sample = {
+        .data = s_data,
+        .frames = SAMPLE_FRAMES,
+        .stereo = stereo,
+        .loop_start = 0,
+        .loop_end = SAMPLE_FRAMES,
+    };
+
+    mixer_init();
+    for (int v = 0; v < voices; v++) {
+        mixer_play(v, &sample);
+        mixer_set_volume(v, 200 + v);
+        mixer_set_pan(v, v * 32 - 128);
+    }
+
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t)(seconds * 1000000);
+    uint64_t frames = 0;
+
+    do {
+        memset(s_buf, 0, sizeof(s_buf));
+        mixer_mix(s_buf, BLOCK);
+        frames += BLOCK;
+    } while (esp_timer_get_time() < end);
+
+    return (esp_timer_get_time() - start) * 1000.0 / frames;
+}
+
+int main(int argc, char **argv)
+{
+    const double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+    for (int i = 0; i < SAMPLE_FRAMES * 2; i++) {
+        s_data[i] = rand();
+    }
+
+    for (int stereo = 0; stereo < 2; stereo++) {
+        printf("%s samples\nvoices  ns/frame  per voice  %% of %d Hz\n", stereo ? "Stereo" : "Mono", RATE);
+
+        double first = 0, last = 0;
+        for (int voices = 0; voices <= MIXER_VOICES; voices++) {
+            double ns = ns_per_frame(voices, stereo, seconds);
+            printf("%6d %9.2f %10.2f %9.3f%%\n", voices, ns, voices ? ns - last : 0.0, ns * RATE / 1e7);
+            first = voices ? first : ns;
+            last = ns;
+        }
+        // Row 0 is the clearing of buf alone
+        printf("average per voice %.2f ns/frame\n\n", (last - first) / MIXER_VOICES);
+    }
+
+    return 0;
+}
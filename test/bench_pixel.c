@@ -0,0 +1,131 @@
+/* Throughput of the pixel.h conversion kernels in Mpixels/s, on one line
+ * and on a whole frame, next to a plain per-pixel loop for each format. The
+ * host compiler may vectorize either; the kernels are written for the
+ * Xtensa core, where the word-at-a-time loads are what pays.
+ *
+ * Usage: bench_pixel [seconds per kernel] */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display.h"
+#include "pixel.h"
+#include "platform.h"
+
+#define LINE (DISPLAY_WIDTH)
+#define FRAME (DISPLAY_WIDTH * DISPLAY_HEIGHT)
+
+static uint8_t s_src[FRAME * 4];
+static uint16_t s_dst[FRAME];
+static uint16_t s_palette[256];
+static volatile uint32_t s_sink;
+
+// Per-pixel loops the kernels replace
+static void plain_rgb888(uint16_t *dst, const uint8_t *src, int count)
+{
+    for (int i = 0; i < count; i++, src += 3) {
+        dst[i] = pixel_bswap16(((src[0] & 0xf8) << 8) | ((src[1] & 0xfc) << 3) | (src[2] >> 3));
+    }
+}
+
+static void plain_rgba8888(uint16_t *dst, const uint8_t *src, int count)
+{
+    for (int i = 0; i < count; i++, src += 4) {
+        dst[i] = pixel_bswap16(((src[0] & 0xf8) << 8) | ((src[1] & 0xfc) << 3) | (src[2] >> 3));
+    }
+}
+
+static void plain_swap16(uint16_t *dst, const uint16_t *src, int count)
+{
+    for (int i = 0; i < count; i++) {
+        dst[i] = pixel_bswap16(src[i]);
+    }
+}
+
+static void plain_indexed(uint16_t *dst, const uint8_t *src, const uint16_t *palette, int count)
+{
+    for (int i = 0; i < count; i++) {
+        dst[i] = palette[src[i]];
+    }
+}
+
+typedef enum { RGB888, RGBA8888, RGB565LE, INDEXED, RGB888_DITHER, RGBA8888_DITHER } kernel_t;
+
+static void convert(kernel_t kernel, bool plain, uint16_t *dst, const uint8_t *src, int count)
+{
+    switch (kernel) {
+        case RGB888:
+            (plain ? plain_rgb888 : pixel_rgb888_to_rgb565)(dst, src, count);
+            break;
+        case RGBA8888:
+            (plain ? plain_rgba8888 : pixel_rgba8888_to_rgb565)(dst, src, count);
+            break;
+        case RGB565LE:
+            (plain ? plain_swap16 : pixel_swap16)(dst, (const uint16_t *)src, count);
+            break;
+        case INDEXED:
+            (plain ? plain_indexed : pixel_expand_indexed)(dst, src, s_palette, count);
+            break;
+        case RGB888_DITHER:
+            pixel_rgb888_to_rgb565_dither(dst, src, count, 0, 0);
+            break;
+        case RGBA8888_DITHER:
+            pixel_rgba8888_to_rgb565_dither(dst, src, count, 0, 0);
+            break;
+    }
+}
+
+static double mpixels(kernel_t kernel, bool plain, int count, double seconds)
+{
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t)(seconds * 1000000);
+    uint64_t pixels = 0;
+
+    do {
+        for (int i = 0; i < 16; i++) {
+            convert(kernel, plain, s_dst, s_src, count);
+            s_sink += s_dst[count - 1];
+        }
+        pixels += 16 * count;
+    } while (esp_timer_get_time() < end);
+
+    return pixels / (double)(esp_timer_get_time() - start);
+}
+
+int main(int argc, char **argv)
+{
+    const double seconds = argc > 1 ? atof(argv[1]) : 0.3;
+    static const struct {
+        kernel_t kernel;
+        const char *name;
+        bool has_plain;
+    } kernels[] = {
+        { RGB888, "rgb888", true },
+        { RGBA8888, "rgba8888", true },
+        { RGB565LE, "rgb565 le", true },
+        { INDEXED, "indexed", true },
+        { RGB888_DITHER, "rgb888 dither", false },
+        { RGBA8888_DITHER, "rgba8888 dither", false },
+    };
+
+    for (int i = 0; i < sizeof(s_src); i++) {
+        s_src[i] = rand();
+    }
+    for (int i = 0; i < 256; i++) {
+        s_palette[i] = rand();
+    }
+
+    printf("Mpixels/s        %10s %10s %10s %11s\n", "line", "frame", "plain line", "plain frame");
+    for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        printf("%-16s %10.1f %10.1f", kernels[i].name,
+            mpixels(kernels[i].kernel, false, LINE, seconds),
+            mpixels(kernels[i].kernel, false, FRAME, seconds));
+        if (kernels[i].has_plain) {
+            printf(" %10.1f %11.1f", mpixels(kernels[i].kernel, true, LINE, seconds),
+                mpixels(kernels[i].kernel, true, FRAME, seconds));
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
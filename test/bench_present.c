@@ -0,0 +1,108 @@
+/* Frame time of a render loop presenting with display_update() against one
+ * double-buffering with display_update_async(), with the host SPI bus taking
+ * real SPI time for its transfers. The difference in time spent blocked on
+ * the display is the CPU that comes back to the renderer.
+ *
+ * Usage: bench_present [frames] */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display.h"
+#include "host_panel.h"
+#include "platform.h"
+
+// Stands in for an emulator: fills the frame and keeps the CPU busy for
+// render_us in total
+static void render(gbuf_t *g, int frame, int render_us)
+{
+    int64_t end = esp_timer_get_time() + render_us;
+
+    for (int y = 0; y < g->height; y++) {
+        uint8_t *p = g->data + y * g->stride;
+        for (int x = 0; x < g->width * 2; x++) {
+            p[x] = x + y + frame;
+        }
+    }
+    while (esp_timer_get_time() < end) {
+    }
+}
+
+typedef struct {
+    int64_t frame_us;
+    int64_t blocked_us;
+} result_t;
+
+static result_t run_sync(int frames, int render_us)
+{
+    int64_t blocked = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < frames; i++) {
+        render(fb, i, render_us);
+
+        int64_t t = esp_timer_get_time();
+        display_update();
+        blocked += esp_timer_get_time() - t;
+    }
+
+    return (result_t){ (esp_timer_get_time() - start) / frames, blocked / frames };
+}
+
+static result_t run_async(int frames, int render_us)
+{
+    gbuf_t *buffers[2] = { fb, gbuf_new(DISPLAY_WIDTH, DISPLAY_HEIGHT, 2, BIG_ENDIAN) };
+    display_fence_t pending = 0;
+    int64_t blocked = 0;
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < frames; i++) {
+        // Render while the previous frame is on the bus
+        fb = buffers[i & 1];
+        render(fb, i, render_us);
+
+        int64_t t = esp_timer_get_time();
+        display_fence_t fence = display_update_async();
+        if (pending) {
+            display_wait(pending);
+        }
+        blocked += esp_timer_get_time() - t;
+        pending = fence;
+    }
+
+    int64_t t = esp_timer_get_time();
+    display_wait(pending);
+    blocked += esp_timer_get_time() - t;
+
+    result_t r = { (esp_timer_get_time() - start) / frames, blocked / frames };
+
+    fb = buffers[0];
+    gbuf_free(buffers[1]);
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    const int frames = argc > 1 ? atoi(argv[1]) : 20;
+    static const int render_ms[] = { 0, 10, 20, 30, 40 };
+
+    host_panel_set_realtime(true);
+    display_init();
+
+    uint64_t bus = host_panel_bus_time_us();
+    display_update();
+    bus = host_panel_bus_time_us() - bus;
+    printf("full frame bus time %.1f ms at 40 MHz\n\n", bus / 1000.0);
+
+    printf("render ms | sync frame ms  blocked | async frame ms  blocked | CPU back ms/frame\n");
+    for (int i = 0; i < sizeof(render_ms) / sizeof(render_ms[0]); i++) {
+        result_t s = run_sync(frames, render_ms[i] * 1000);
+        result_t a = run_async(frames, render_ms[i] * 1000);
+        printf("%9d | %13.1f %8.1f | %14.1f %8.1f | %17.1f\n", render_ms[i],
+            s.frame_us / 1000.0, s.blocked_us / 1000.0,
+            a.frame_us / 1000.0, a.blocked_us / 1000.0,
+            (s.blocked_us - a.blocked_us) / 1000.0);
+    }
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+/* Bytes sent and saved per frame by each present mode, as reported by
+ * display_get_frame_bytes(), over the same frame sequences, with the SPI
+ * time that leaves per frame at 40 MHz.
+ *
+ * Usage: bench_present_modes [recording.fbc ...]
+ * Without arguments the synthetic scenes of sequence.c are used. */
+
+#include <stdio.h>
+
+#include "display.h"
+#include "host_panel.h"
+#include "sequence.h"
+
+static const struct {
+    display_present_mode_t mode;
+    const char *name;
+} s_modes[] = {
+    { DISPLAY_PRESENT_FULL, "full" },
+    { DISPLAY_PRESENT_TILE_DIFF, "tile diff" },
+    { DISPLAY_PRESENT_LINE_DIFF, "line diff" },
+    { DISPLAY_PRESENT_INTERLACED, "interlaced" },
+};
+
+static void run(const char *name, int m)
+{
+    sequence_t *seq = sequence_open(name);
+    if (!seq) {
+        printf("%s: not a scene or recording\n", name);
+        return;
+    }
+
+    display_set_present_mode(s_modes[m].mode);
+
+    int frames = 0;
+    uint64_t sent_total = 0, saved_total = 0, bus_us = 0;
+
+    while (sequence_next(seq, fb)) {
+        uint64_t bus = host_panel_bus_time_us();
+        display_update();
+        bus_us += host_panel_bus_time_us() - bus;
+
+        uint32_t sent, saved;
+        display_get_frame_bytes(&sent, &saved);
+        sent_total += sent;
+        saved_total += saved;
+        frames++;
+    }
+    sequence_close(seq);
+
+    if (frames) {
+        printf("%-24s %-10s %9.1f %9.1f %6.1f%% %8.2f\n", name, s_modes[m].name,
+            sent_total / 1024.0 / frames, saved_total / 1024.0 / frames,
+            100.0 * saved_total / (sent_total + saved_total), bus_us / 1000.0 / frames);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    display_init();
+
+    printf("%-24s %-10s %9s %9s %7s %8s\n", "sequence", "mode", "sent KB", "saved KB", "saved", "bus ms");
+    const char *const *names = argc > 1 ? (const char *const *)argv + 1 : sequence_scenes;
+    for (int i = 0; names[i]; i++) {
+        for (int m = 0; m < sizeof(s_modes) / sizeof(s_modes[0]); m++) {
+            run(names[i], m);
+        }
+    }
+
+    return 0;
+}
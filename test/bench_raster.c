@@ -0,0 +1,155 @@
+/* Microbenchmarks of the raster.h primitives on RGB16 gbufs: ns per call
+ * and Mpixels/s for a 16x16 sprite and a full 320x240 screen, with the
+ * per-pixel loops they replace for fill and blit.
+ *
+ * Usage: bench_raster [seconds per case] */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display.h"
+#include "platform.h"
+#include "raster.h"
+
+static gbuf_t *s_dst;
+static gbuf_t *s_src;
+static gbuf_t *s_pattern;
+static double s_seconds;
+
+typedef void (*draw_t)(int size);
+
+static void plain_fill(int size)
+{
+    for (int y = 0; y < size; y++) {
+        uint16_t *p = (uint16_t *)(s_dst->data + y * s_dst->stride);
+        for (int x = 0; x < size * 4 / 3; x++) {
+            p[x] = 0x1234;
+        }
+    }
+}
+
+static void plain_blit(int size)
+{
+    for (int y = 0; y < size; y++) {
+        uint16_t *d = (uint16_t *)(s_dst->data + y * s_dst->stride);
+        const uint16_t *s = (const uint16_t *)(s_src->data + y * s_src->stride);
+        for (int x = 0; x < size * 4 / 3; x++) {
+            d[x] = s[x];
+        }
+    }
+}
+
+// Sizes are heights; rects are 4:3 like the screen
+static rect_t area(int size)
+{
+    return (rect_t){ 0, 0, size * 4 / 3, size };
+}
+
+static void fill(int size)
+{
+    raster_fill_rect(s_dst, area(size), 0x1234);
+}
+
+static void fill_pattern(int size)
+{
+    raster_fill_pattern(s_dst, area(size), s_pattern);
+}
+
+static void hline(int size)
+{
+    for (int y = 0; y < size; y++) {
+        raster_hline(s_dst, 0, y, size * 4 / 3, 0x1234);
+    }
+}
+
+static void vline(int size)
+{
+    for (int x = 0; x < size * 4 / 3; x++) {
+        raster_vline(s_dst, x, 0, size, 0x1234);
+    }
+}
+
+static void blit(int size)
+{
+    raster_blit(s_dst, (point_t){ 0, 0 }, s_src, area(size));
+}
+
+static void blit_odd(int size)
+{
+    // Source and destination on different halfword alignments
+    raster_blit(s_dst, (point_t){ 1, 0 }, s_src, area(size));
+}
+
+static void blit_key(int size)
+{
+    raster_blit_key(s_dst, (point_t){ 0, 0 }, s_src, area(size), 0);
+}
+
+static void blend_half(int size)
+{
+    raster_blend_half(s_dst, (point_t){ 0, 0 }, s_src, area(size));
+}
+
+static void blend_alpha(int size)
+{
+    raster_blend_alpha(s_dst, (point_t){ 0, 0 }, s_src, area(size), 96);
+}
+
+static void bench(const char *name, draw_t draw)
+{
+    static const int sizes[] = { 12, 240 };
+
+    printf("%-14s", name);
+    for (int i = 0; i < 2; i++) {
+        const int size = sizes[i];
+        int64_t start = esp_timer_get_time();
+        int64_t end = start + (int64_t)(s_seconds * 1000000);
+        uint64_t calls = 0;
+
+        do {
+            for (int k = 0; k < 16; k++) {
+                draw(size);
+            }
+            calls += 16;
+        } while (esp_timer_get_time() < end);
+
+        double us = esp_timer_get_time() - start;
+        double pixels = (double)calls * (size * 4 / 3) * size;
+        printf(" %12.0f %10.1f", us * 1000 / calls, pixels / us);
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    s_seconds = argc > 1 ? atof(argv[1]) : 0.3;
+
+    s_dst = gbuf_new(DISPLAY_WIDTH + 1, DISPLAY_HEIGHT, 2, LITTLE_ENDIAN);
+    s_src = gbuf_new(DISPLAY_WIDTH, DISPLAY_HEIGHT, 2, LITTLE_ENDIAN);
+    s_pattern = gbuf_new(8, 8, 2, LITTLE_ENDIAN);
+    for (int i = 0; i < s_src->stride * s_src->height; i++) {
+        s_src->data[i] = rand() & 1 ? rand() : 0;
+    }
+    for (int i = 0; i < s_pattern->stride * s_pattern->height; i++) {
+        s_pattern->data[i] = rand();
+    }
+
+    printf("%-14s %12s %10s %12s %10s\n", "", "16x12 ns", "Mpix/s", "320x240 ns", "Mpix/s");
+    bench("fill_rect", fill);
+    bench("  plain loop", plain_fill);
+    bench("fill_pattern", fill_pattern);
+    bench("hline", hline);
+    bench("vline", vline);
+    bench("blit", blit);
+    bench("blit unaligned", blit_odd);
+    bench("  plain loop", plain_blit);
+    bench("blit_key", blit_key);
+    bench("blend_half", blend_half);
+    bench("blend_alpha", blend_alpha);
+
+    // Panel order buffers, byte swapped on this CPU
+    s_dst->endian = s_src->endian = BIG_ENDIAN;
+    bench("blend_half be", blend_half);
+
+    return 0;
+}
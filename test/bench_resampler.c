@@ -0,0 +1,162 @@
+/* Quality and cost of each resampler mode, for the rate conversions cores
+ * need. Quality is the SNR of a resampled sine: the output is fitted with a
+ * sine of the same frequency, anything left over is noise, aliasing or
+ * distortion. Tones past the output Nyquist frequency should be removed;
+ * their level in the output is reported as rejection. Cost is ns per output
+ * frame, input fed in 256-frame blocks.
+ *
+ * Usage: bench_resampler */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "platform.h"
+#include "resampler.h"
+
+#define OUT_RATE (32000)
+#define BLOCK (256)
+#define OUT_FRAMES (16384)
+#define SETTLE (256)
+
+#define IN_FRAMES (OUT_FRAMES * 2 + BLOCK)
+
+static short s_in[IN_FRAMES * 2];
+static short s_out[(OUT_FRAMES + BLOCK * 4) * 2];
+
+static const char *const s_mode_names[] = { "linear", "sinc" };
+
+// A tone of amplitude 0.5 in s_in, enough for OUT_FRAMES from rates up to
+// twice OUT_RATE
+static void make_tone(int in_rate, double hz)
+{
+    for (int i = 0; i < IN_FRAMES; i++) {
+        short v = 16384 * sin(2 * M_PI * hz * i / in_rate);
+        s_in[i * 2] = v;
+        s_in[i * 2 + 1] = v;
+    }
+}
+
+// Resample s_in into s_out a block at a time, returns the frames written
+static int resample(resampler_t *r)
+{
+    int produced = 0;
+    int offset = 0;
+
+    while (produced < OUT_FRAMES) {
+        int used = BLOCK;
+        produced += resampler_process(r, s_in + offset * 2, &used, s_out + produced * 2, BLOCK * 4);
+        offset += used;
+    }
+
+    return produced;
+}
+
+// Least squares fit of a cos + b sin at hz to the left channel after the
+// filter settled. Returns the signal and residual power.
+static void fit(int frames, double hz, double *signal, double *residual)
+{
+    const double w = 2 * M_PI * hz / OUT_RATE;
+    double cc = 0, ss = 0, cs = 0, yc = 0, ys = 0;
+
+    for (int i = SETTLE; i < frames; i++) {
+        double c = cos(w * i), s = sin(w * i), y = s_out[i * 2];
+        cc += c * c;
+        ss += s * s;
+        cs += c * s;
+        yc += y * c;
+        ys += y * s;
+    }
+
+    const double det = cc * ss - cs * cs;
+    const double a = (yc * ss - ys * cs) / det;
+    const double b = (ys * cc - yc * cs) / det;
+
+    double sig = 0, res = 0;
+    for (int i = SETTLE; i < frames; i++) {
+        double model = a * cos(w * i) + b * sin(w * i);
+        double e = s_out[i * 2] - model;
+        sig += model * model;
+        res += e * e;
+    }
+
+    *signal = sig;
+    *residual = res;
+}
+
+static double snr_db(int in_rate, resampler_mode_t mode, double hz)
+{
+    resampler_t *r = resampler_new(in_rate, OUT_RATE, mode);
+    make_tone(in_rate, hz);
+    int frames = resample(r);
+    resampler_free(r);
+
+    double signal, residual;
+    fit(frames, hz, &signal, &residual);
+    return 10 * log10(signal / residual);
+}
+
+// Output level of a tone the output rate can't hold, against full input
+static double rejection_db(int in_rate, resampler_mode_t mode, double hz)
+{
+    resampler_t *r = resampler_new(in_rate, OUT_RATE, mode);
+    make_tone(in_rate, hz);
+    int frames = resample(r);
+    resampler_free(r);
+
+    double power = 0;
+    for (int i = SETTLE; i < frames; i++) {
+        power += (double)s_out[i * 2] * s_out[i * 2];
+    }
+    power /= frames - SETTLE;
+    return 10 * log10(power / (16384.0 * 16384.0 / 2));
+}
+
+static double ns_per_frame(int in_rate, resampler_mode_t mode)
+{
+    resampler_t *r = resampler_new(in_rate, OUT_RATE, mode);
+    make_tone(in_rate, 1000);
+    resample(r);
+
+    int64_t start = esp_timer_get_time();
+    long frames = 0;
+    for (int i = 0; i < 20; i++) {
+        resampler_reset(r);
+        frames += resample(r);
+    }
+    double elapsed = esp_timer_get_time() - start;
+    resampler_free(r);
+
+    return elapsed * 1000 / frames;
+}
+
+int main(void)
+{
+    static const int rates[] = { 22050, 31400, 44100, 48000 };
+    static const double tones[] = { 440, 3000, 10000 };
+
+    printf("to %d Hz      mode   ", OUT_RATE);
+    for (int t = 0; t < sizeof(tones) / sizeof(tones[0]); t++) {
+        printf(" SNR %5.0f", tones[t]);
+    }
+    printf("  reject   ns/frame\n");
+
+    for (int i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        for (resampler_mode_t mode = RESAMPLER_LINEAR; mode <= RESAMPLER_SINC; mode++) {
+            printf("from %5d Hz  %-7s", rates[i], s_mode_names[mode]);
+            for (int t = 0; t < sizeof(tones) / sizeof(tones[0]); t++) {
+                printf(" %6.1f dB", snr_db(rates[i], mode, tones[t]));
+            }
+
+            // A tone past 16 kHz the input can carry
+            if (rates[i] > OUT_RATE + 2000) {
+                printf(" %5.1f dB", rejection_db(rates[i], mode, (OUT_RATE / 2 + rates[i] / 2) / 2));
+            } else {
+                printf(" %8s", "-");
+            }
+            printf(" %10.1f\n", ns_per_frame(rates[i], mode));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+/* Sweep of chunk height and ring depth: effective MB/s of full presents
+ * against the LCD_SPI_CLOCK_RATE ceiling, with the host SPI bus taking real
+ * time per transaction. Each configuration runs in its own process, as
+ * display_init() is once per boot. The host converts chunks faster than
+ * the device, so the gap a shallow ring leaves is smaller here; run the same
+ * sweep on the device for its numbers.
+ *
+ * Usage: bench_ring [frames] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "display.h"
+#include "host_panel.h"
+#include "platform.h"
+
+#define CLOCK_HZ (40000000)
+
+static void run(int chunk_lines, int ring_depth, int frames)
+{
+    display_config_t config = DISPLAY_CONFIG_DEFAULT();
+    config.chunk_lines = chunk_lines;
+    config.ring_depth = ring_depth;
+
+    host_panel_set_realtime(true);
+    display_init_config(&config);
+    display_update();
+
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < frames; i++) {
+        display_update();
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+
+    double mbps = (double)frames * DISPLAY_WIDTH * DISPLAY_HEIGHT * 2 / elapsed;
+    printf(" %5.2f (%2.0f%%)", mbps, 100 * mbps / (CLOCK_HZ / 8 / 1e6));
+}
+
+int main(int argc, char **argv)
+{
+    const int frames = argc > 1 ? atoi(argv[1]) : 20;
+    static const int chunk_lines[] = { 1, 2, 5, 10, 20, 40 };
+    static const int ring_depth[] = { 1, 2, 3, 4, 8 };
+
+    printf("MB/s of full frames, ceiling %.2f MB/s at %d MHz\n\n", CLOCK_HZ / 8 / 1e6, CLOCK_HZ / 1000000);
+    printf("lines \\ depth");
+    for (int d = 0; d < sizeof(ring_depth) / sizeof(ring_depth[0]); d++) {
+        printf(" %12d", ring_depth[d]);
+    }
+    printf("\n");
+
+    for (int c = 0; c < sizeof(chunk_lines) / sizeof(chunk_lines[0]); c++) {
+        printf("%13d", chunk_lines[c]);
+        fflush(stdout);
+
+        for (int d = 0; d < sizeof(ring_depth) / sizeof(ring_depth[0]); d++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                run(chunk_lines[c], ring_depth[d], frames);
+                fflush(stdout);
+                _exit(0);
+            }
+            waitpid(pid, NULL, 0);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
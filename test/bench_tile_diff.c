@@ -0,0 +1,61 @@
+/* Full presents against tile diff presents of the same frame sequences:
+ * SPI time and bytes per frame on a 40 MHz bus (window commands included),
+ * the frame rate that bus time allows, and the host time each present took
+ * (hashing included).
+ *
+ * Usage: bench_tile_diff [recording.fbc ...]
+ * Without arguments the synthetic scenes of sequence.c are used. */
+
+#include <stdio.h>
+
+#include "display.h"
+#include "host_panel.h"
+#include "platform.h"
+#include "sequence.h"
+
+static void run(const char *name, display_present_mode_t mode, const char *label)
+{
+    sequence_t *seq = sequence_open(name);
+    if (!seq) {
+        printf("%s: not a scene or recording\n", name);
+        return;
+    }
+
+    display_set_present_mode(mode);
+
+    int frames = 0;
+    uint64_t bus_us = 0;
+    uint64_t bytes = host_panel_bus_bytes();
+    int64_t host_us = 0;
+
+    while (sequence_next(seq, fb)) {
+        uint64_t bus = host_panel_bus_time_us();
+        int64_t t = esp_timer_get_time();
+        display_update();
+        host_us += esp_timer_get_time() - t;
+        bus_us += host_panel_bus_time_us() - bus;
+        frames++;
+    }
+    sequence_close(seq);
+    bytes = host_panel_bus_bytes() - bytes;
+
+    if (frames) {
+        double bus_ms = bus_us / 1000.0 / frames;
+        printf("%-24s %-9s %8.1f %8.2f %8.0f %8.0f\n", name, label,
+            bytes / 1024.0 / frames, bus_ms, 1000 / bus_ms, (double)host_us / frames);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    display_init();
+
+    printf("%-24s %-9s %8s %8s %8s %8s\n", "sequence", "mode", "KB/frame", "bus ms", "max fps", "host us");
+    const char *const *names = argc > 1 ? (const char *const *)argv + 1 : sequence_scenes;
+    for (int i = 0; names[i]; i++) {
+        run(names[i], DISPLAY_PRESENT_FULL, "full");
+        run(names[i], DISPLAY_PRESENT_TILE_DIFF, "tile diff");
+    }
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+/* Test assertions: a failed CHECK prints its message and location and is
+ * counted in s_failures, which main() turns into the exit status. Each test
+ * is a single translation unit. */
+
+#include <stdio.h>
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            s_failures++; \
+        } \
+    } while (0)
@@ -0,0 +1,188 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "display_host.h"
+#include "ili9341.h"
+
+/*
+ The image is panel memory, TFT_PAGES rows of TFT_COLUMNS pixels. Windows
+ are mapped into it through MADCTL as the panel does, and the pages shown on
+ screen through the vertical scroll area.
+
+ Transfers complete as they are queued, so every fence is done by the time
+ it is returned. Each call is accounted as the SPI backend would send it: a
+ window is five transactions with 11 bytes, a pixel run two transactions and
+ a command one or two.
+*/
+
+static uint16_t *s_image = NULL;
+static rect_t s_window;
+static int s_cursor = 0;
+static uint8_t s_madctl = 0;
+static uint32_t s_fence = 0;
+// Top fixed and scrolled pages, and the memory page shown first in the area
+static short s_scroll[2] = { 0, TFT_PAGES };
+static short s_scroll_start = 0;
+
+static uint32_t s_clock_hz = 40000000;
+static uint32_t s_transaction_ns = 2000;
+static uint64_t s_bus_ns = 0;
+
+static void host_account(int transactions, uint32_t bytes)
+{
+    s_bus_ns += (uint64_t)transactions * s_transaction_ns;
+    s_bus_ns += (uint64_t)bytes * 8 * 1000000000u / s_clock_hz;
+    s_fence += transactions;
+}
+
+static void host_init(const display_config_t *config)
+{
+    s_image = calloc(TFT_PAGES * TFT_COLUMNS, sizeof(uint16_t));
+    if (!s_image) abort();
+
+    s_window = (rect_t){ 0, 0, TFT_COLUMNS, TFT_PAGES };
+}
+
+// Panel memory address of logical position (x, y)
+static uint16_t *host_address(int x, int y)
+{
+    int column = s_madctl & MADCTL_MV ? y : x;
+    int page = s_madctl & MADCTL_MV ? x : y;
+
+    if (s_madctl & MADCTL_MX) {
+        column = TFT_COLUMNS - 1 - column;
+    }
+    if (s_madctl & MADCTL_MY) {
+        page = TFT_PAGES - 1 - page;
+    }
+
+    return &s_image[page * TFT_COLUMNS + column];
+}
+
+static uint32_t host_window(short x, short y, short width, short height)
+{
+    assert(x >= 0 && y >= 0 && width > 0 && height > 0);
+    if (s_madctl & MADCTL_MV) {
+        assert(x + width <= TFT_PAGES && y + height <= TFT_COLUMNS);
+    } else {
+        assert(x + width <= TFT_COLUMNS && y + height <= TFT_PAGES);
+    }
+
+    s_window = (rect_t){ x, y, width, height };
+    s_cursor = 0;
+
+    host_account(5, 11);
+    return s_fence;
+}
+
+static uint32_t host_pixels(const uint16_t *pixels, int count)
+{
+    const int area = s_window.width * s_window.height;
+
+    // Like the panel, wrap around to the window start when it is full
+    for (int i = 0; i < count; i++) {
+        int x = s_window.x + s_cursor % s_window.width;
+        int y = s_window.y + s_cursor / s_window.width;
+        *host_address(x, y) = pixels[i];
+        s_cursor = (s_cursor + 1) % area;
+    }
+
+    host_account(2, 1 + count * 2);
+    return s_fence;
+}
+
+static uint32_t host_command(uint8_t cmd, const uint8_t *data, int len)
+{
+    if (cmd == TFT_CMD_SWRESET) {
+        s_madctl = 0;
+        s_scroll[0] = 0;
+        s_scroll[1] = TFT_PAGES;
+        s_scroll_start = 0;
+    } else if (cmd == TFT_CMD_MADCTL && len > 0) {
+        s_madctl = data[0];
+    } else if (cmd == TFT_CMD_VSCRDEF && len >= 6) {
+        s_scroll[0] = (data[0] << 8) | data[1];
+        s_scroll[1] = (data[2] << 8) | data[3];
+        assert(s_scroll[0] + s_scroll[1] + ((data[4] << 8) | data[5]) == TFT_PAGES);
+    } else if (cmd == TFT_CMD_VSCRSADD && len >= 2) {
+        s_scroll_start = (data[0] << 8) | data[1];
+    }
+
+    host_account(len > 0 ? 2 : 1, 1 + len);
+    return s_fence;
+}
+
+static void host_wait(uint32_t fence)
+{
+}
+
+const display_backend_t display_backend_host = {
+    .init = host_init,
+    .window = host_window,
+    .pixels = host_pixels,
+    .command = host_command,
+    .wait = host_wait,
+};
+
+void display_host_set_bus(uint32_t clock_hz, uint32_t transaction_ns)
+{
+    s_clock_hz = clock_hz;
+    s_transaction_ns = transaction_ns;
+}
+
+uint64_t display_host_bus_time_us(void)
+{
+    return s_bus_ns / 1000;
+}
+
+void display_host_reset_bus_time(void)
+{
+    s_bus_ns = 0;
+}
+
+// Memory page shown on screen page page. Within the scroll area the pages
+// start at s_scroll_start and wrap around at its end.
+static int host_scrolled(int page)
+{
+    const int top = s_scroll[0], area = s_scroll[1];
+
+    if (area <= 0 || page < top || page >= top + area) {
+        return page;
+    }
+    return top + ((page - top + s_scroll_start - top) % area + area) % area;
+}
+
+uint16_t display_host_pixel(short x, short y)
+{
+    // Landscape view, as display.c programs MADCTL by default
+    const uint8_t *p = (const uint8_t *)&s_image[host_scrolled(TFT_PAGES - 1 - x) * TFT_COLUMNS + y];
+    return (p[0] << 8) | p[1];
+}
+
+int display_host_write_ppm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return -1;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", DISPLAY_WIDTH, DISPLAY_HEIGHT);
+
+    uint8_t line[DISPLAY_WIDTH * 3];
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            uint16_t c = display_host_pixel(x, y);
+            uint8_t r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+            line[x * 3 + 0] = (r << 3) | (r >> 2);
+            line[x * 3 + 1] = (g << 2) | (g >> 4);
+            line[x * 3 + 2] = (b << 3) | (b >> 2);
+        }
+        if (fwrite(line, 1, sizeof(line), f) != sizeof(line)) {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
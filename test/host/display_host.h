@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "display_backend.h"
+
+/* The host backend, for host builds only. It keeps panel memory in an
+ * image, and accounts the time the same transfers would take on the SPI bus.
+ * Windows and memory writes are emulated along with MADCTL and vertical
+ * scrolling; other panel commands (init) are accounted but not emulated. */
+
+extern const display_backend_t display_backend_host;
+
+/* Bus clock and the fixed cost of one queued transaction, in ns */
+void display_host_set_bus(uint32_t clock_hz, uint32_t transaction_ns);
+/* Simulated bus time since the last reset, in us */
+uint64_t display_host_bus_time_us(void);
+void display_host_reset_bus_time(void);
+
+/* RGB565 pixel on screen, the image through the scroll area, seen in the
+ * default landscape orientation, in DISPLAY_WIDTH x DISPLAY_HEIGHT
+ * coordinates */
+uint16_t display_host_pixel(short x, short y);
+/* Write that view as a binary PPM, returns 0 on success */
+int display_host_write_ppm(const char *path);
@@ -0,0 +1,27 @@
+#pragma once
+
+/* Host GPIO: output levels are only kept, for the SPI stand-in to read the
+ * panel's D/C line */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    GPIO_NUM_5 = 5,
+    GPIO_NUM_18 = 18,
+    GPIO_NUM_19 = 19,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_23 = 23,
+    GPIO_NUM_25 = 25,
+    GPIO_NUM_26 = 26,
+    GPIO_NUM_MAX = 40,
+} gpio_num_t;
+
+typedef enum {
+    GPIO_MODE_INPUT = 1,
+    GPIO_MODE_OUTPUT = 2,
+} gpio_mode_t;
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level);
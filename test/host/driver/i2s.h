@@ -0,0 +1,36 @@
+#pragma once
+
+/* Host I2S: writes are paced at the configured sample rate and dropped */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+    I2S_NUM_0 = 0,
+} i2s_port_t;
+
+#define I2S_MODE_MASTER (1)
+#define I2S_MODE_TX (4)
+#define I2S_MODE_DAC_BUILT_IN (16)
+#define I2S_CHANNEL_FMT_RIGHT_LEFT (0)
+#define I2S_COMM_FORMAT_I2S_MSB (2)
+#define ESP_INTR_FLAG_LEVEL1 (1 << 1)
+
+typedef struct {
+    int mode;
+    int sample_rate;
+    int bits_per_sample;
+    int channel_format;
+    int communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    int use_apll;
+} i2s_config_t;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue);
+esp_err_t i2s_set_pin(i2s_port_t port, const void *pins);
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks);
@@ -0,0 +1,5 @@
+#pragma once
+
+/* Host RTC IO: the pin numbers come from the GPIO stand-in */
+
+#include "driver/gpio.h"
@@ -0,0 +1,43 @@
+#pragma once
+
+/* Host stand-in for the FreeRTOS subset the component uses, on pthreads.
+ * Ticks are milliseconds; critical sections share one recursive lock. */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE (0)
+#define pdTRUE (1)
+#define pdPASS (1)
+#define pdFAIL (0)
+
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ (1000)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+#define tskNO_AFFINITY (0x7fffffff)
+
+#define DRAM_ATTR
+#define IRAM_ATTR
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+void host_enter_critical(void);
+void host_exit_critical(void);
+
+#define portENTER_CRITICAL(mux) ((void)(mux), host_enter_critical())
+#define portEXIT_CRITICAL(mux) ((void)(mux), host_exit_critical())
+
+/* "ISRs" run on ordinary threads, there is nothing to yield to */
+#define portYIELD_FROM_ISR()
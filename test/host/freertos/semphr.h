@@ -0,0 +1,13 @@
+#pragma once
+
+#include "freertos/queue.h"
+
+/* Semaphores are queues of empty items, mutexes start out given */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreTake(sem, ticks) xQueueReceive((sem), NULL, (ticks))
+#define xSemaphoreGive(sem) xQueueSend((sem), NULL, 0)
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
@@ -0,0 +1,370 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "driver/i2s.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+struct host_task {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+    TaskFunction_t fn;
+    void *arg;
+};
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct host_event_group {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    EventBits_t bits;
+};
+
+static pthread_mutex_t s_critical;
+static pthread_once_t s_critical_once = PTHREAD_ONCE_INIT;
+static __thread struct host_task *s_self = NULL;
+
+static void critical_init(void)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_critical, &attr);
+}
+
+void host_enter_critical(void)
+{
+    pthread_once(&s_critical_once, critical_init);
+    pthread_mutex_lock(&s_critical);
+}
+
+void host_exit_critical(void)
+{
+    pthread_mutex_unlock(&s_critical);
+}
+
+// Wait on cond until deadline, or for good without one; false on timeout
+static bool cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *lock, const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(cond, lock);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+static struct timespec *deadline_after(struct timespec *ts, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    uint64_t ns = ts->tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000u;
+    ts->tv_sec += ns / 1000000000u;
+    ts->tv_nsec = ns % 1000000000u;
+    return ts;
+}
+
+static struct host_task *task_new(TaskFunction_t fn, void *arg)
+{
+    struct host_task *t = calloc(1, sizeof(*t));
+    assert(t);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    t->fn = fn;
+    t->arg = arg;
+    return t;
+}
+
+static void *task_main(void *arg)
+{
+    s_self = arg;
+    s_self->fn(s_self->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    struct host_task *t = task_new(fn, arg);
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, task_main, t) != 0) {
+        free(t);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+
+    if (handle) {
+        *handle = t;
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_size, void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_size, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only a task deleting itself is supported; its handle stays valid
+    assert(task == NULL || task == s_self);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    // Threads not created as tasks, like main, get a handle on first use
+    if (!s_self) {
+        s_self = task_new(NULL, NULL);
+    }
+    return s_self;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_broadcast(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken) {
+        *woken = pdFALSE;
+    }
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct host_task *t = xTaskGetCurrentTaskHandle();
+    struct timespec ts;
+    struct timespec *deadline = deadline_after(&ts, ticks);
+
+    pthread_mutex_lock(&t->lock);
+    while (t->notify == 0 && cond_wait_ticks(&t->cond, &t->lock, deadline)) {
+    }
+    uint32_t value = t->notify;
+    if (value) {
+        t->notify = clear ? 0 : value - 1;
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *q = calloc(1, sizeof(*q));
+    if (!q) return NULL;
+
+    q->items = malloc(length * (item_size ? item_size : 1));
+    if (!q->items) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t q)
+{
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->cond);
+    free(q->items);
+    free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = ticks ? deadline_after(&ts, ticks) : NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->length) {
+        if (ticks == 0 || !cond_wait_ticks(&q->cond, &q->lock, deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+
+    // Semaphores are queues without items
+    if (q->item_size && item) {
+        memcpy(q->items + (q->head + q->count) % q->length * q->item_size, item, q->item_size);
+    }
+    q->count++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = ticks ? deadline_after(&ts, ticks) : NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        if (ticks == 0 || !cond_wait_ticks(&q->cond, &q->lock, deadline)) {
+            pthread_mutex_unlock(&q->lock);
+            return pdFALSE;
+        }
+    }
+
+    if (q->item_size) {
+        memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    }
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q)
+{
+    pthread_mutex_lock(&q->lock);
+    UBaseType_t count = q->count;
+    pthread_mutex_unlock(&q->lock);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    if (sem) {
+        xSemaphoreGive(sem);
+    }
+    return sem;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct host_event_group *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->cond, NULL);
+    return g;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    pthread_mutex_destroy(&group->lock);
+    pthread_cond_destroy(&group->cond);
+    free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t value = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t value = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return value;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = deadline_after(&ts, ticks);
+
+    pthread_mutex_lock(&group->lock);
+    while (true) {
+        EventBits_t set = group->bits & bits;
+        if ((all ? set == bits : set != 0) || ticks == 0 ||
+            !cond_wait_ticks(&group->cond, &group->lock, deadline)) {
+            break;
+        }
+    }
+
+    EventBits_t value = group->bits;
+    EventBits_t set = value & bits;
+    if (clear && (all ? set == bits : set != 0)) {
+        group->bits &= ~bits;
+    }
+    pthread_mutex_unlock(&group->lock);
+
+    return value;
+}
+
+static int s_i2s_rate = 44100;
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queue_size, void *queue)
+{
+    s_i2s_rate = config->sample_rate;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const void *pins)
+{
+    return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks)
+{
+    // Stereo 16-bit frames leave at the sample rate
+    usleep((useconds_t)((uint64_t)size / 4 * 1000000 / s_i2s_rate));
+    *written = size;
+    return ESP_OK;
+}
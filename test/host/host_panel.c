@@ -0,0 +1,439 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "host_panel.h"
+
+#define PANEL_COLUMNS (240)
+#define PANEL_PAGES (320)
+#define PANEL_DC (GPIO_NUM_21)
+
+#define CMD_SWRESET (0x01)
+#define CMD_CASET (0x2a)
+#define CMD_PASET (0x2b)
+#define CMD_RAMWR (0x2c)
+#define CMD_VSCRDEF (0x33)
+#define CMD_MADCTL (0x36)
+#define CMD_VSCRSADD (0x37)
+#define CMD_RAMWR_CONTINUE (0x3c)
+
+#define MADCTL_MY (0x80)
+#define MADCTL_MX (0x40)
+#define MADCTL_MV (0x20)
+
+#define TRANSACTION_NS (2000)
+// The driver's limit with DMA when max_transfer_sz is 0
+#define DEFAULT_MAX_TRANSFER (4092)
+
+/*
+ The queue holds the transactions queued and not yet collected, oldest at
+ head, of which the first sent have been through the bus thread. As in the
+ driver, queue_size limits the transactions waiting for the bus, and the
+ results are kept until collected.
+*/
+#define RESULTS (64)
+
+struct host_spi_device {
+    spi_device_interface_config_t config;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    spi_transaction_t **queue;
+    uint64_t *queued_ns;
+    int size;
+    int head;
+    int count;
+    int sent;
+};
+
+static struct host_spi_device s_device;
+static int s_max_transfer = DEFAULT_MAX_TRANSFER;
+static uint32_t s_levels[GPIO_NUM_MAX];
+
+static bool s_realtime = false;
+static uint64_t s_bus_ns = 0;
+static uint64_t s_bus_bytes = 0;
+
+// Panel memory is PANEL_PAGES rows of PANEL_COLUMNS pixels
+static uint16_t s_memory[PANEL_PAGES * PANEL_COLUMNS];
+static uint8_t s_madctl = 0;
+static uint8_t s_cmd = 0;
+static int s_args = 0;
+static uint8_t s_arg[6];
+static int s_columns[2] = { 0, PANEL_COLUMNS - 1 };
+static int s_pages[2] = { 0, PANEL_PAGES - 1 };
+static int s_cursor = 0;
+// Scroll area as top fixed lines and scrolled lines, and the memory page
+// shown first in it
+static int s_scroll[2] = { 0, PANEL_PAGES };
+static int s_scroll_start = 0;
+
+esp_err_t gpio_set_direction(gpio_num_t gpio, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio, uint32_t level)
+{
+    s_levels[gpio] = level;
+    return ESP_OK;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// Wait on the device until deadline, or for good without one; false on timeout
+static bool device_wait(const struct timespec *deadline)
+{
+    if (!deadline) {
+        pthread_cond_wait(&s_device.cond, &s_device.lock);
+        return true;
+    }
+    return pthread_cond_timedwait(&s_device.cond, &s_device.lock, deadline) != ETIMEDOUT;
+}
+
+static struct timespec *deadline_after(struct timespec *ts, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return NULL;
+    }
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    uint64_t ns = ts->tv_nsec + (uint64_t)ticks * portTICK_PERIOD_MS * 1000000u;
+    ts->tv_sec += ns / 1000000000u;
+    ts->tv_nsec = ns % 1000000000u;
+    return ts;
+}
+
+// Memory write at the cursor, which wraps around to the window start like
+// the panel's once the window is full
+static void panel_write(uint16_t pixel)
+{
+    const int width = s_columns[1] - s_columns[0] + 1;
+    const int height = s_pages[1] - s_pages[0] + 1;
+    assert(width > 0 && height > 0);
+
+    int x = s_columns[0] + s_cursor % width;
+    int y = s_pages[0] + s_cursor / width;
+    s_cursor = (s_cursor + 1) % (width * height);
+
+    int column = s_madctl & MADCTL_MV ? y : x;
+    int page = s_madctl & MADCTL_MV ? x : y;
+    assert(column < PANEL_COLUMNS && page < PANEL_PAGES);
+
+    if (s_madctl & MADCTL_MX) {
+        column = PANEL_COLUMNS - 1 - column;
+    }
+    if (s_madctl & MADCTL_MY) {
+        page = PANEL_PAGES - 1 - page;
+    }
+
+    s_memory[page * PANEL_COLUMNS + column] = pixel;
+}
+
+static void panel_command(uint8_t cmd)
+{
+    s_cmd = cmd;
+    s_args = 0;
+
+    if (cmd == CMD_SWRESET) {
+        s_madctl = 0;
+        s_scroll[0] = 0;
+        s_scroll[1] = PANEL_PAGES;
+        s_scroll_start = 0;
+    } else if (cmd == CMD_RAMWR) {
+        s_cursor = 0;
+    }
+}
+
+static void panel_data(const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++, s_args++) {
+        switch (s_cmd) {
+            case CMD_CASET:
+            case CMD_PASET:
+                if (s_args < 4) {
+                    s_arg[s_args] = data[i];
+                }
+                if (s_args == 3) {
+                    int *range = s_cmd == CMD_CASET ? s_columns : s_pages;
+                    range[0] = (s_arg[0] << 8) | s_arg[1];
+                    range[1] = (s_arg[2] << 8) | s_arg[3];
+                }
+                break;
+
+            case CMD_MADCTL:
+                if (s_args == 0) {
+                    s_madctl = data[i];
+                }
+                break;
+
+            case CMD_VSCRDEF:
+                // Top fixed, scrolled and bottom fixed lines, which must
+                // add up to the panel's
+                if (s_args < 6) {
+                    s_arg[s_args] = data[i];
+                }
+                if (s_args == 5) {
+                    s_scroll[0] = (s_arg[0] << 8) | s_arg[1];
+                    s_scroll[1] = (s_arg[2] << 8) | s_arg[3];
+                    assert(s_scroll[0] + s_scroll[1] + ((s_arg[4] << 8) | s_arg[5]) == PANEL_PAGES);
+                }
+                break;
+
+            case CMD_VSCRSADD:
+                if (s_args < 2) {
+                    s_arg[s_args] = data[i];
+                }
+                if (s_args == 1) {
+                    s_scroll_start = (s_arg[0] << 8) | s_arg[1];
+                }
+                break;
+
+            case CMD_RAMWR:
+            case CMD_RAMWR_CONTINUE:
+                // Pixels are big endian RGB565 on the wire
+                if (s_args & 1) {
+                    panel_write((s_arg[0] << 8) | data[i]);
+                } else {
+                    s_arg[0] = data[i];
+                }
+                break;
+        }
+    }
+}
+
+static void *bus_main(void *arg)
+{
+    struct host_spi_device *dev = arg;
+    uint64_t busy_until = 0;
+
+    pthread_mutex_lock(&dev->lock);
+    while (true) {
+        while (dev->sent == dev->count) {
+            pthread_cond_wait(&dev->cond, &dev->lock);
+        }
+        const int k = (dev->head + dev->sent) % dev->size;
+        spi_transaction_t *t = dev->queue[k];
+        uint64_t start = dev->queued_ns[k];
+        pthread_mutex_unlock(&dev->lock);
+
+        if (dev->config.pre_cb) {
+            dev->config.pre_cb(t);
+        }
+
+        uint64_t ns = TRANSACTION_NS + (uint64_t)t->length * 1000000000u / dev->config.clock_speed_hz;
+        if (s_realtime) {
+            // From when it was queued or the bus got free, however late this
+            // thread woke up
+            busy_until = (busy_until > start ? busy_until : start) + ns;
+            struct timespec ts = { busy_until / 1000000000u, busy_until % 1000000000u };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+            }
+        }
+
+        const uint8_t *data = t->flags & SPI_TRANS_USE_TXDATA ? t->tx_data : t->tx_buffer;
+        if (s_levels[PANEL_DC]) {
+            panel_data(data, t->length / 8);
+        } else {
+            for (int i = 0; i < t->length / 8; i++) {
+                panel_command(data[i]);
+            }
+        }
+
+        // The driver posts the result in the same interrupt as post_cb, so
+        // whoever post_cb wakes finds it
+        pthread_mutex_lock(&dev->lock);
+        s_bus_ns += ns;
+        s_bus_bytes += t->length / 8;
+        dev->sent++;
+        pthread_cond_broadcast(&dev->cond);
+        pthread_mutex_unlock(&dev->lock);
+
+        if (dev->config.post_cb) {
+            dev->config.post_cb(t);
+        }
+
+        pthread_mutex_lock(&dev->lock);
+    }
+
+    return NULL;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *config, int dma_chan)
+{
+    if (config->max_transfer_sz > 0) {
+        s_max_transfer = config->max_transfer_sz;
+    }
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *config, spi_device_handle_t *handle)
+{
+    assert(!s_device.queue);
+
+    s_device.config = *config;
+    s_device.size = config->queue_size + RESULTS;
+    s_device.queue = calloc(s_device.size, sizeof(spi_transaction_t *));
+    s_device.queued_ns = calloc(s_device.size, sizeof(uint64_t));
+    if (!s_device.queue || !s_device.queued_ns) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&s_device.lock, NULL);
+    pthread_cond_init(&s_device.cond, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, bus_main, &s_device) != 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    pthread_detach(thread);
+
+    *handle = &s_device;
+    return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t dev, spi_transaction_t *trans, TickType_t ticks)
+{
+    if ((trans->flags & SPI_TRANS_USE_TXDATA) ? trans->length > 32 : trans->length > s_max_transfer * 8) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct timespec ts;
+    struct timespec *deadline = deadline_after(&ts, ticks);
+
+    pthread_mutex_lock(&dev->lock);
+    while (dev->count - dev->sent == dev->config.queue_size) {
+        if (ticks == 0 || !device_wait(deadline)) {
+            pthread_mutex_unlock(&dev->lock);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    // More uncollected results than this are a leak
+    assert(dev->count < dev->size);
+    const int k = (dev->head + dev->count) % dev->size;
+    dev->queue[k] = trans;
+    dev->queued_ns[k] = now_ns();
+    dev->count++;
+    pthread_cond_broadcast(&dev->cond);
+    pthread_mutex_unlock(&dev->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t dev, spi_transaction_t **trans, TickType_t ticks)
+{
+    struct timespec ts;
+    struct timespec *deadline = deadline_after(&ts, ticks);
+
+    pthread_mutex_lock(&dev->lock);
+    while (dev->sent == 0) {
+        if (ticks == 0 || !device_wait(deadline)) {
+            pthread_mutex_unlock(&dev->lock);
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+
+    *trans = dev->queue[dev->head];
+    dev->head = (dev->head + 1) % dev->size;
+    dev->count--;
+    dev->sent--;
+    pthread_cond_broadcast(&dev->cond);
+    pthread_mutex_unlock(&dev->lock);
+
+    return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t dev, spi_transaction_t *trans)
+{
+    esp_err_t ret = spi_device_queue_trans(dev, trans, portMAX_DELAY);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    spi_transaction_t *done;
+    ret = spi_device_get_trans_result(dev, &done, portMAX_DELAY);
+    assert(ret != ESP_OK || done == trans);
+    return ret;
+}
+
+void host_panel_set_realtime(bool realtime)
+{
+    s_realtime = realtime;
+}
+
+uint64_t host_panel_bus_time_us(void)
+{
+    pthread_mutex_lock(&s_device.lock);
+    uint64_t ns = s_bus_ns;
+    pthread_mutex_unlock(&s_device.lock);
+    return ns / 1000;
+}
+
+uint64_t host_panel_bus_bytes(void)
+{
+    pthread_mutex_lock(&s_device.lock);
+    uint64_t bytes = s_bus_bytes;
+    pthread_mutex_unlock(&s_device.lock);
+    return bytes;
+}
+
+void host_panel_reset_bus_time(void)
+{
+    pthread_mutex_lock(&s_device.lock);
+    s_bus_ns = 0;
+    pthread_mutex_unlock(&s_device.lock);
+}
+
+// Memory page shown on screen page page. Within the scroll area the pages
+// start at s_scroll_start and wrap around at its end.
+static int panel_scrolled(int page)
+{
+    const int top = s_scroll[0], area = s_scroll[1];
+
+    if (area <= 0 || page < top || page >= top + area) {
+        return page;
+    }
+    return top + ((page - top + s_scroll_start - top) % area + area) % area;
+}
+
+uint16_t host_panel_pixel(short x, short y)
+{
+    return s_memory[panel_scrolled(PANEL_PAGES - 1 - x) * PANEL_COLUMNS + y];
+}
+
+int host_panel_write_ppm(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return -1;
+    }
+
+    fprintf(f, "P6\n%d %d\n255\n", PANEL_PAGES, PANEL_COLUMNS);
+
+    uint8_t line[PANEL_PAGES * 3];
+    for (int y = 0; y < PANEL_COLUMNS; y++) {
+        for (int x = 0; x < PANEL_PAGES; x++) {
+            uint16_t c = host_panel_pixel(x, y);
+            uint8_t r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+            line[x * 3 + 0] = (r << 3) | (r >> 2);
+            line[x * 3 + 1] = (g << 2) | (g >> 4);
+            line[x * 3 + 2] = (b << 3) | (b >> 2);
+        }
+        if (fwrite(line, 1, sizeof(line), f) != sizeof(line)) {
+            fclose(f);
+            return -1;
+        }
+    }
+
+    return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The host SPI master has an ILI9341 on its bus. A bus thread sends the
+ * queued transactions in order, calling the device callbacks around each,
+ * and their bytes drive a model of the panel: column and page windows,
+ * memory writes, MADCTL and vertical scrolling. Other commands are accounted
+ * but not emulated.
+ *
+ * Each transaction costs a fixed 2 us plus its bits at the device clock.
+ * By default the bus thread completes transactions as soon as it gets to
+ * them. In realtime mode it takes their bus time in wall-clock time, so
+ * the caller and the display task overlap with the bus as on the device. */
+
+/* Set before display_init */
+void host_panel_set_realtime(bool realtime);
+/* Simulated bus time since the last reset, in us */
+uint64_t host_panel_bus_time_us(void);
+void host_panel_reset_bus_time(void);
+/* Bytes sent since display_init, commands and arguments included */
+uint64_t host_panel_bus_bytes(void);
+
+/* RGB565 pixel on screen, that is panel memory through the scroll area, seen
+ * in the default landscape orientation (MADCTL MV | MY), in DISPLAY_WIDTH x
+ * DISPLAY_HEIGHT coordinates */
+uint16_t host_panel_pixel(short x, short y);
+/* Write that view as a binary PPM, returns 0 on success */
+int host_panel_write_ppm(const char *path);
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sequence.h"
+
+#define SCENE_FRAMES (120)
+
+const char *const sequence_scenes[] = { "menu", "sprites", "scroll", NULL };
+
+struct sequence {
+    int scene;
+    int frame;
+    FILE *f;
+    int width;
+    int height;
+    uint16_t *rows;
+};
+
+static uint16_t background(int x, int y)
+{
+    return ((x >> 4) ^ (y >> 4)) & 1 ? 0x39e7 : 0x1082 + (y >> 3);
+}
+
+static void put(gbuf_t *dst, int x, int y, uint16_t c)
+{
+    if (x >= 0 && y >= 0 && x < dst->width && y < dst->height) {
+        uint8_t *p = dst->data + y * dst->stride + x * 2;
+        p[0] = c >> 8;
+        p[1] = c;
+    }
+}
+
+static void fill(gbuf_t *dst, int x0, int y0, int w, int h, uint16_t c)
+{
+    for (int y = y0; y < y0 + h; y++) {
+        for (int x = x0; x < x0 + w; x++) {
+            put(dst, x, y, c);
+        }
+    }
+}
+
+// menu: a static screen with a cursor blinking every 15 frames
+// sprites: a static background with eight 16x16 sprites moving over it
+// scroll: the background scrolling a pixel a frame, all of it changes
+static void draw_scene(sequence_t *seq, gbuf_t *dst)
+{
+    const int t = seq->frame;
+    const int dx = seq->scene == 2 ? t : 0;
+
+    for (int y = 0; y < dst->height; y++) {
+        for (int x = 0; x < dst->width; x++) {
+            put(dst, x, y, background(x + dx, y));
+        }
+    }
+
+    switch (seq->scene) {
+        case 0:
+            fill(dst, 40, 60, 240, 120, 0x0010);
+            if ((t / 15) & 1) {
+                fill(dst, 52, 76 + 16 * ((t / 30) % 6), 8, 8, 0xffff);
+            }
+            break;
+        case 1:
+            for (int i = 0; i < 8; i++) {
+                int x = (i * 37 + t * (1 + i % 3)) % (dst->width + 16) - 16;
+                int y = 20 + i * 26 + (t * (i & 1 ? 1 : -1) % 8);
+                fill(dst, x, y, 16, 16, 0xf800 | (i << 6));
+            }
+            break;
+    }
+}
+
+sequence_t *sequence_open(const char *name)
+{
+    sequence_t *seq = calloc(1, sizeof(sequence_t));
+    if (!seq) abort();
+
+    for (int i = 0; sequence_scenes[i]; i++) {
+        if (strcmp(name, sequence_scenes[i]) == 0) {
+            seq->scene = i;
+            return seq;
+        }
+    }
+
+    // FBC1 recording, see tools/capture_decode.py
+    uint8_t header[8];
+    seq->f = fopen(name, "rb");
+    if (!seq->f || fread(header, 1, 8, seq->f) != 8 || memcmp(header, "FBC1", 4) != 0) {
+        sequence_close(seq);
+        return NULL;
+    }
+
+    seq->width = header[4] | (header[5] << 8);
+    seq->height = header[6] | (header[7] << 8);
+    seq->rows = calloc(seq->width * seq->height, sizeof(uint16_t));
+    if (!seq->rows) abort();
+
+    return seq;
+}
+
+static bool read_frame(sequence_t *seq)
+{
+    uint8_t header[6];
+    if (fread(header, 1, 6, seq->f) != 6) {
+        return false;
+    }
+
+    int count = header[4] | (header[5] << 8);
+    for (int i = 0; i < count; i++) {
+        uint8_t run[4];
+        if (fread(run, 1, 4, seq->f) != 4) {
+            return false;
+        }
+
+        int y = run[0] | (run[1] << 8);
+        int lines = run[2] | (run[3] << 8);
+        if (y + lines > seq->height) {
+            return false;
+        }
+
+        // Pixels are little endian, as are the hosts this runs on
+        size_t n = (size_t)lines * seq->width;
+        if (fread(seq->rows + y * seq->width, 2, n, seq->f) != n) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool sequence_next(sequence_t *seq, gbuf_t *dst)
+{
+    if (!seq->f) {
+        if (seq->frame == SCENE_FRAMES) {
+            return false;
+        }
+        draw_scene(seq, dst);
+        seq->frame++;
+        return true;
+    }
+
+    if (!read_frame(seq)) {
+        return false;
+    }
+
+    for (int y = 0; y < dst->height; y++) {
+        for (int x = 0; x < dst->width; x++) {
+            bool inside = x < seq->width && y < seq->height;
+            put(dst, x, y, inside ? seq->rows[y * seq->width + x] : 0);
+        }
+    }
+    seq->frame++;
+    return true;
+}
+
+void sequence_close(sequence_t *seq)
+{
+    if (seq->f) {
+        fclose(seq->f);
+    }
+    free(seq->rows);
+    free(seq);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "gbuf.h"
+
+/* Frame sequences for the present benchmarks: a few synthetic scenes, or a
+ * display_capture_start() recording replayed frame by frame. Frames are
+ * drawn into an RGB16 big endian gbuf such as fb; recordings of another size
+ * are clipped or padded with black. */
+
+typedef struct sequence sequence_t;
+
+/* Names of the synthetic scenes, NULL terminated */
+extern const char *const sequence_scenes[];
+
+/* A scene name or the path of a recording, NULL if neither */
+sequence_t *sequence_open(const char *name);
+/* Draw the next frame into dst, false at the end of the sequence */
+bool sequence_next(sequence_t *seq, gbuf_t *dst);
+void sequence_close(sequence_t *seq);
@@ -0,0 +1,45 @@
+/* The ring between audio_submit() and the I2S feeder task: a submit never
+ * blocks, drops what does not fit and counts it, and the feeder drains the
+ * ring at the sample rate, counting an underrun when it runs dry. */
+
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio.h"
+#include "check.h"
+
+#define RATE (32000)
+
+static short s_buf[AUDIO_RING_FRAMES * 2 * 2];
+
+int main(void)
+{
+    audio_init(RATE);
+
+    audio_stats_t stats;
+    audio_get_stats(&stats);
+    CHECK(stats.capacity == AUDIO_RING_FRAMES, "capacity %d", stats.capacity);
+
+    // Twice the ring at once: about half is dropped
+    int queued = audio_submit(s_buf, AUDIO_RING_FRAMES * 2);
+    audio_get_stats(&stats);
+    CHECK(queued >= AUDIO_RING_FRAMES && queued < AUDIO_RING_FRAMES * 2, "%d frames queued", queued);
+    CHECK(stats.overruns == AUDIO_RING_FRAMES * 2 - queued, "%u frames counted as dropped for %d",
+        stats.overruns, AUDIO_RING_FRAMES * 2 - queued);
+    CHECK(stats.fill <= AUDIO_RING_FRAMES, "fill %d past the ring", stats.fill);
+
+    // The feeder drains a full ring in AUDIO_RING_FRAMES / RATE seconds
+    int fill = audio_fill();
+    vTaskDelay(pdMS_TO_TICKS(20));
+    CHECK(audio_fill() < fill, "ring not drained, %d frames left of %d", audio_fill(), fill);
+
+    vTaskDelay(pdMS_TO_TICKS(1000 * AUDIO_RING_FRAMES / RATE + 50));
+    audio_get_stats(&stats);
+    CHECK(stats.fill == 0 && stats.underruns == 1, "fill %d and %u underruns once drained",
+        stats.fill, stats.underruns);
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,175 @@
+/* audio_submit()'s integer conversion against the float algorithm it
+ * replaced, which is kept here verbatim: the output must be bit-identical
+ * for every sample at every volume. Also prints the time per frame of the
+ * float algorithm and of audio_convert(), run on the same buffer.
+ *
+ * Usage: test_audio_convert [volumes] */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#include "audio.h"
+#include "check.h"
+#include "platform.h"
+
+#define FRAMES (65536)
+
+// audio_submit()'s conversion before the integer path
+static void reference_convert(short *buf, int len)
+{
+    if (audio_volume == 0.0f) {
+        for (int i = 0; i < len; i += 2) {
+            buf[i] = 0;
+        }
+    } else {
+        for (int i = 0; i < len * 2; i += 2) {
+            int dac0, dac1;
+
+            /* Down mix stero to mono in sample */
+            int sample = ((int)buf[i] + (int)buf[i + 1]) >> 1;
+
+            /* Normalize */
+            const float normalized = (float)sample / 0x8000;
+
+            /* Scale */
+            const int magnitude = 127 + 127;
+            const float range = magnitude * normalized * audio_volume;
+
+            /* Convert to differential output */
+            if (range > 127) {
+                dac1 = (range - 127);
+                dac0 = 127;
+            }
+            else if (range < -127) {
+                dac1  = (range + 127);
+                dac0 = -127;
+            } else {
+                dac1 = 0;
+                dac0 = range;
+            }
+
+            dac0 += 0x80;
+            dac1 = 0x80 - dac1;
+
+            dac0 <<= 8;
+            dac1 <<= 8;
+
+            buf[i] = (short)dac1;
+            buf[i + 1] = (short)dac0;
+        }
+    }
+}
+
+static short s_input[FRAMES * 2];
+static short s_expected[FRAMES * 2];
+static short s_actual[FRAMES * 2];
+
+// Every mono sample once, from equal and from differing channels
+static void make_input(void)
+{
+    for (int i = 0; i < FRAMES; i++) {
+        short v = i - 0x8000;
+        if (i & 1) {
+            s_input[i * 2] = v;
+            s_input[i * 2 + 1] = v;
+        } else {
+            s_input[i * 2] = v / 2 + (rand() & 1);
+            s_input[i * 2 + 1] = v - s_input[i * 2] + v;
+        }
+    }
+}
+
+static void check_volume(float volume)
+{
+    audio_volume = volume;
+
+    memcpy(s_expected, s_input, sizeof(s_input));
+    reference_convert(s_expected, FRAMES);
+
+    memcpy(s_actual, s_input, sizeof(s_input));
+    audio_submit(s_actual, FRAMES);
+
+    int bad = 0;
+    for (int i = 0; i < FRAMES * 2; i++) {
+        bad += s_actual[i] != s_expected[i];
+    }
+    CHECK(bad == 0, "volume %.9g: %d samples differ", volume, bad);
+}
+
+// TSC cycles on x86, elsewhere the platform.h cycle count (ns on a host)
+#ifdef __x86_64__
+#define TICKS "cycles"
+#else
+#define TICKS "ns"
+#endif
+
+static uint64_t ticks(void)
+{
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    return xthal_get_ccount();
+#endif
+}
+
+static void bench(float volume)
+{
+    const int rounds = 50;
+    const int len = 512;
+    uint64_t old_ticks = 0, new_ticks = 0;
+
+    audio_volume = volume;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < FRAMES; i += len) {
+            memcpy(s_actual, s_input + i * 2, len * 2 * sizeof(short));
+            uint64_t t = ticks();
+            reference_convert(s_actual, len);
+            old_ticks += ticks() - t;
+
+            memcpy(s_actual, s_input + i * 2, len * 2 * sizeof(short));
+            t = ticks();
+            audio_convert(s_actual, len);
+            new_ticks += ticks() - t;
+        }
+    }
+
+    const double frames = (double)rounds * FRAMES;
+    printf("volume %-4g float %6.2f  convert %6.2f  " TICKS "/frame\n", volume,
+        old_ticks / frames, new_ticks / frames);
+}
+
+int main(int argc, char **argv)
+{
+    const int volumes = argc > 1 ? atoi(argv[1]) : 400;
+
+    audio_init(32000);
+    make_input();
+
+    // Evenly spread over the fixed point range and past it, both signs,
+    // plus the edges
+    for (int i = 0; i <= volumes; i++) {
+        float v = 2.5f * i / volumes;
+        check_volume(v);
+        check_volume(-v);
+    }
+    static const float edges[] = { 1.0f / 4096, 2.0f, 0.9999999f, 1.0f, 1.0000001f, 0.5f, 0.25f, 1e-6f, 100.0f };
+    for (int i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        check_volume(edges[i]);
+        check_volume(-edges[i]);
+        check_volume(nextafterf(edges[i], 0));
+        check_volume(nextafterf(edges[i], 10));
+    }
+
+    bench(1.0f);
+    bench(0.7f);
+    // Past the table, audio_convert() falls back to the float algorithm
+    bench(3.0f);
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,472 @@
+/* audio_stream playback of WAV files: 16 and 8-bit PCM and IMA ADPCM,
+ * mono and stereo, seeking, loops, odd-sized chunks, and closing from a
+ * task with a stale notification pending. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "audio_stream.h"
+#include "check.h"
+
+#define PATH "test_audio_stream.wav"
+#define FRAMES (20000)
+
+#define ADPCM_BLOCK_ALIGN (256)
+#define ADPCM_BLOCKS (10)
+/* Frames in a block: the header sample, then eight per channel and word */
+#define ADPCM_BLOCK_FRAMES(channels) ((ADPCM_BLOCK_ALIGN / (4 * (channels)) - 1) * 8 + 1)
+/* Words per channel in the short block at the end */
+#define ADPCM_TAIL_WORDS (3)
+#define ADPCM_MAX_FRAMES (ADPCM_BLOCKS * ADPCM_BLOCK_FRAMES(1) + ADPCM_TAIL_WORDS * 8 + 1)
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    put_le16(p, v);
+    put_le16(p + 2, v >> 16);
+}
+
+static short left(int i)
+{
+    return i * 7;
+}
+
+static short right(int i)
+{
+    return -i * 3;
+}
+
+// Write PATH with a fmt chunk of fmt_size bytes (the format fields, then
+// zeros), an odd-sized chunk the stream must skip, and the data
+static void write_wav(uint16_t format, uint16_t channels, uint16_t block_align, uint16_t bits,
+    uint16_t frames_per_block, uint32_t fmt_size, const uint8_t *data, uint32_t data_size)
+{
+    uint8_t fmt[32] = { 0 };
+    put_le16(fmt + 0, format);
+    put_le16(fmt + 2, channels);
+    put_le32(fmt + 4, 32000);
+    put_le32(fmt + 8, 32000 * block_align);
+    put_le16(fmt + 12, block_align);
+    put_le16(fmt + 14, bits);
+    if (format != 1) {
+        put_le16(fmt + 16, 2);
+        put_le16(fmt + 18, frames_per_block);
+    }
+
+    static const uint8_t list[3] = { 'a', 'b', 'c' };
+    const uint8_t zero = 0;
+    uint8_t header[8];
+
+    FILE *f = fopen(PATH, "wb");
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, 4 + 8 + fmt_size + (fmt_size & 1) + 8 + 4 + 8 + data_size + (data_size & 1));
+    fwrite(header, 1, 8, f);
+    fwrite("WAVE", 1, 4, f);
+
+    memcpy(header, "fmt ", 4);
+    put_le32(header + 4, fmt_size);
+    fwrite(header, 1, 8, f);
+    fwrite(fmt, 1, fmt_size, f);
+    if (fmt_size & 1) {
+        fwrite(&zero, 1, 1, f);
+    }
+
+    memcpy(header, "LIST", 4);
+    put_le32(header + 4, sizeof(list));
+    fwrite(header, 1, 8, f);
+    fwrite(list, 1, sizeof(list), f);
+    fwrite(&zero, 1, 1, f);
+
+    memcpy(header, "data", 4);
+    put_le32(header + 4, data_size);
+    fwrite(header, 1, 8, f);
+    fwrite(data, 1, data_size, f);
+    if (data_size & 1) {
+        fwrite(&zero, 1, 1, f);
+    }
+    fclose(f);
+}
+
+static void write_pcm16(uint32_t fmt_size)
+{
+    uint8_t *data = malloc(FRAMES * 4);
+    for (int i = 0; i < FRAMES; i++) {
+        put_le16(data + i * 4, left(i));
+        put_le16(data + i * 4 + 2, right(i));
+    }
+    write_wav(1, 2, 4, 16, 0, fmt_size, data, FRAMES * 4);
+    free(data);
+}
+
+static int check_frames(const short *buf, int first, int count)
+{
+    int bad = 0;
+    for (int i = 0; i < count; i++) {
+        bad += buf[i * 2] != left(first + i) || buf[i * 2 + 1] != right(first + i);
+    }
+    return bad;
+}
+
+// Read up to frames frames in reads of step, as a player would
+static int read_all(audio_stream_t *s, short *buf, int frames, int step)
+{
+    int n = 0;
+    while (n < frames) {
+        int got = audio_stream_read(s, buf + n * 2, frames - n < step ? frames - n : step);
+        if (got == 0) {
+            break;
+        }
+        n += got;
+    }
+    return n;
+}
+
+static void test_read(void)
+{
+    static short buf[FRAMES * 2];
+    audio_stream_t *s;
+
+    write_pcm16(16);
+    CHECK(audio_stream_open(PATH, &s) == ESP_OK, "open");
+    if (!s) {
+        return;
+    }
+    CHECK(audio_stream_sample_rate(s) == 32000, "rate");
+    CHECK(audio_stream_length(s) == FRAMES, "length %u", audio_stream_length(s));
+
+    int n = read_all(s, buf, FRAMES + 1, 333);
+    CHECK(n == FRAMES, "read %d frames", n);
+    CHECK(check_frames(buf, 0, n) == 0, "frame contents");
+
+    CHECK(audio_stream_seek(s, 12345) == ESP_OK, "seek");
+    n = audio_stream_read(s, buf, 1000);
+    CHECK(n == 1000 && check_frames(buf, 12345, n) == 0, "frames after seek");
+
+    audio_stream_close(s);
+}
+
+// A fmt chunk of odd size is followed by a pad byte, also when the stream
+// reads all of it
+static void test_odd_fmt(void)
+{
+    static const uint32_t sizes[] = { 17, 19, 21 };
+    short buf[100 * 2];
+
+    for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        audio_stream_t *s = NULL;
+        write_pcm16(sizes[i]);
+        CHECK(audio_stream_open(PATH, &s) == ESP_OK, "open with a %u byte fmt chunk", sizes[i]);
+        if (s) {
+            CHECK(audio_stream_length(s) == FRAMES, "length %u", audio_stream_length(s));
+            int n = audio_stream_read(s, buf, 100);
+            CHECK(n == 100 && check_frames(buf, 0, n) == 0, "frames with a %u byte fmt chunk", sizes[i]);
+            audio_stream_close(s);
+        }
+    }
+}
+
+static void test_pcm8(int channels)
+{
+    // An odd number of mono frames leaves an odd-sized data chunk
+    const int frames = 4001;
+    uint8_t *data = malloc(frames * channels);
+    static short buf[4001 * 2];
+    audio_stream_t *s = NULL;
+
+    for (int i = 0; i < frames * channels; i++) {
+        data[i] = i * 13 + i / 7;
+    }
+    write_wav(1, channels, channels, 8, 0, 16, data, frames * channels);
+
+    CHECK(audio_stream_open(PATH, &s) == ESP_OK, "8-bit %d channel open", channels);
+    if (s) {
+        CHECK(audio_stream_length(s) == frames, "8-bit length %u", audio_stream_length(s));
+        int n = read_all(s, buf, frames + 1, 500);
+        CHECK(n == frames, "8-bit %d channel read %d frames", channels, n);
+
+        // Unsigned samples around 0x80, scaled to 16 bits; mono on both sides
+        int bad = 0;
+        for (int i = 0; i < n; i++) {
+            short l = (data[i * channels] - 0x80) << 8;
+            short r = (data[i * channels + channels - 1] - 0x80) << 8;
+            bad += buf[i * 2] != l || buf[i * 2 + 1] != r;
+        }
+        CHECK(bad == 0, "8-bit %d channel: %d frames off", channels, bad);
+        audio_stream_close(s);
+    }
+
+    free(data);
+}
+
+/* IMA ADPCM as the WAV format has it. The encoder keeps the decoder's state,
+ * so the samples it reconstructs are what a decoder must output. */
+static const int16_t ima_step[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+    796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026,
+    4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767,
+};
+static const int8_t ima_index[16] = { -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8 };
+
+typedef struct {
+    int predictor;
+    int index;
+} ima_state_t;
+
+static int ima_encode(ima_state_t *st, int sample, short *decoded)
+{
+    int step = ima_step[st->index];
+    int diff = sample - st->predictor;
+    int nibble = 0;
+
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+    if (diff >= step) {
+        nibble |= 4;
+        diff -= step;
+    }
+    if (diff >= step >> 1) {
+        nibble |= 2;
+        diff -= step >> 1;
+    }
+    if (diff >= step >> 2) {
+        nibble |= 1;
+    }
+
+    int delta = step >> 3;
+    if (nibble & 4) delta += step;
+    if (nibble & 2) delta += step >> 1;
+    if (nibble & 1) delta += step >> 2;
+    st->predictor += nibble & 8 ? -delta : delta;
+    st->predictor = st->predictor > 32767 ? 32767 : st->predictor < -32768 ? -32768 : st->predictor;
+    st->index += ima_index[nibble];
+    st->index = st->index < 0 ? 0 : st->index > 88 ? 88 : st->index;
+
+    *decoded = st->predictor;
+    return nibble;
+}
+
+// A triangle per channel, steep enough to move the step index around
+static short adpcm_source(int channel, int i)
+{
+    int period = channel ? 97 : 331;
+    int phase = i % period;
+    int level = phase < period / 2 ? phase : period - phase;
+    return level * (channel ? 600 : 190) - 16000;
+}
+
+static short s_adpcm_expected[ADPCM_MAX_FRAMES * 2];
+
+// Encode ADPCM_BLOCKS full blocks and a short one into data, filling in
+// s_adpcm_expected. Returns the data size.
+static uint32_t adpcm_encode(int channels, uint8_t *data, int *frames)
+{
+    ima_state_t st[2] = { { 0, 0 }, { 0, 0 } };
+    uint32_t size = 0;
+    int frame = 0;
+
+    for (int b = 0; b <= ADPCM_BLOCKS; b++) {
+        const int words = b < ADPCM_BLOCKS ? ADPCM_BLOCK_ALIGN / (4 * channels) - 1 : ADPCM_TAIL_WORDS;
+        uint8_t *block = data + size;
+
+        // Header: the first sample as is, and the step index carried over
+        for (int c = 0; c < channels; c++) {
+            st[c].predictor = adpcm_source(c, frame);
+            put_le16(block + c * 4, st[c].predictor);
+            block[c * 4 + 2] = st[c].index;
+            block[c * 4 + 3] = 0;
+            s_adpcm_expected[frame * 2 + c] = st[c].predictor;
+        }
+        frame++;
+
+        // Words of eight samples alternate between channels, low nibble first
+        for (int w = 0; w < words; w++) {
+            for (int c = 0; c < channels; c++) {
+                uint8_t *word = block + 4 * channels + (w * channels + c) * 4;
+                memset(word, 0, 4);
+                for (int k = 0; k < 8; k++) {
+                    int nibble = ima_encode(&st[c], adpcm_source(c, frame + k), &s_adpcm_expected[(frame + k) * 2 + c]);
+                    word[k / 2] |= k & 1 ? nibble << 4 : nibble;
+                }
+            }
+            frame += 8;
+        }
+
+        size += 4 * channels * (words + 1);
+    }
+
+    if (channels == 1) {
+        for (int i = 0; i < frame; i++) {
+            s_adpcm_expected[i * 2 + 1] = s_adpcm_expected[i * 2];
+        }
+    }
+
+    *frames = frame;
+    return size;
+}
+
+static int count_adpcm_mismatches(const short *buf, int first, int count)
+{
+    int bad = 0;
+    for (int i = 0; i < count * 2; i++) {
+        bad += buf[i] != s_adpcm_expected[first * 2 + i];
+    }
+    return bad;
+}
+
+static void test_adpcm(int channels)
+{
+    static uint8_t data[(ADPCM_BLOCKS + 1) * ADPCM_BLOCK_ALIGN];
+    static short buf[(ADPCM_MAX_FRAMES + 1) * 2];
+    const int block_frames = ADPCM_BLOCK_FRAMES(channels);
+    audio_stream_t *s = NULL;
+    int frames;
+
+    uint32_t size = adpcm_encode(channels, data, &frames);
+    CHECK(frames == ADPCM_BLOCKS * block_frames + ADPCM_TAIL_WORDS * 8 + 1, "encoded %d frames", frames);
+    write_wav(0x11, channels, ADPCM_BLOCK_ALIGN, 4, block_frames, 20, data, size);
+
+    CHECK(audio_stream_open(PATH, &s) == ESP_OK, "ADPCM %d channel open", channels);
+    if (!s) {
+        return;
+    }
+    CHECK(audio_stream_length(s) == frames, "ADPCM length %u, expected %d", audio_stream_length(s), frames);
+
+    int n = read_all(s, buf, frames + 1, 100);
+    CHECK(n == frames, "ADPCM %d channel read %d frames", channels, n);
+    CHECK(count_adpcm_mismatches(buf, 0, n) == 0, "ADPCM %d channel frames off", channels);
+
+    // Seeks restart at the block holding the frame: to a block's header
+    // frame, into one, to its last frame and into the short block
+    const int targets[] = { block_frames * 3, block_frames * 3 + 100, block_frames * 5 - 1,
+        ADPCM_BLOCKS * block_frames + 10, 1 };
+    for (int i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        CHECK(audio_stream_seek(s, targets[i]) == ESP_OK, "ADPCM seek to %d", targets[i]);
+        int want = frames - targets[i] < 300 ? frames - targets[i] : 300;
+        n = audio_stream_read(s, buf, 300);
+        CHECK(n == want && count_adpcm_mismatches(buf, targets[i], n) == 0, "ADPCM %d channel after seek to %d",
+            channels, targets[i]);
+    }
+
+    CHECK(audio_stream_seek(s, frames) == ESP_OK && audio_stream_read(s, buf, 10) == 0, "seek to the end");
+    CHECK(audio_stream_seek(s, frames + 1) != ESP_OK, "seek past the end");
+
+    audio_stream_close(s);
+}
+
+static void test_loop(void)
+{
+    static short buf[3000 * 2];
+    audio_stream_t *s = NULL;
+
+    write_pcm16(16);
+    CHECK(audio_stream_open(PATH, &s) == ESP_OK, "loop open");
+    if (!s) {
+        return;
+    }
+
+    CHECK(audio_stream_set_loop(s, 0, FRAMES + 1) != ESP_OK, "loop past the end");
+    CHECK(audio_stream_set_loop(s, 300, 300) != ESP_OK, "empty loop");
+    CHECK(audio_stream_set_loop(s, 400, 300) != ESP_OK, "reversed loop");
+
+    // From the start into the loop, then round it several times; the loop
+    // takes effect within a read
+    CHECK(audio_stream_set_loop(s, 1000, 1700) == ESP_OK, "loop");
+    int n = read_all(s, buf, 3000, 777);
+    int bad = 0;
+    for (int i = 0; i < n; i++) {
+        int frame = i < 1700 ? i : 1000 + (i - 1700) % 700;
+        bad += check_frames(&buf[i * 2], frame, 1);
+    }
+    CHECK(n == 3000 && bad == 0, "%d looped frames, %d off", n, bad);
+
+    // 0, 0 plays on to the end
+    CHECK(audio_stream_set_loop(s, 0, 0) == ESP_OK, "loop off");
+    n = read_all(s, buf, 3000, 777);
+    CHECK(n == 3000 && check_frames(buf, 1000 + 1300 % 700, n) == 0, "frames after the loop is off");
+
+    // A loop over the whole track keeps playing past its end
+    CHECK(audio_stream_set_loop(s, 0, FRAMES) == ESP_OK && audio_stream_seek(s, FRAMES - 100) == ESP_OK,
+        "loop over the track");
+    n = read_all(s, buf, 300, 64);
+    CHECK(n == 300 && check_frames(buf, FRAMES - 100, 100) == 0 && check_frames(&buf[200], 0, 200) == 0,
+        "wrap around the track");
+
+    audio_stream_close(s);
+
+    // ADPCM loops restart within a block
+    static uint8_t data[(ADPCM_BLOCKS + 1) * ADPCM_BLOCK_ALIGN];
+    int frames;
+    uint32_t size = adpcm_encode(2, data, &frames);
+    write_wav(0x11, 2, ADPCM_BLOCK_ALIGN, 4, ADPCM_BLOCK_FRAMES(2), 20, data, size);
+    CHECK(audio_stream_open(PATH, &s) == ESP_OK, "ADPCM loop open");
+    if (!s) {
+        return;
+    }
+    CHECK(audio_stream_set_loop(s, 150, 420) == ESP_OK, "ADPCM loop");
+    n = read_all(s, buf, 1000, 333);
+    bad = 0;
+    for (int i = 0; i < n; i++) {
+        int frame = i < 420 ? i : 150 + (i - 420) % 270;
+        bad += count_adpcm_mismatches(&buf[i * 2], frame, 1);
+    }
+    CHECK(n == 1000 && bad == 0, "%d looped ADPCM frames, %d samples off", n, bad);
+    audio_stream_close(s);
+}
+
+// close() must wait for the reader even when the task's notification slot
+// already holds a wake
+static void close_task(void *arg)
+{
+    TaskHandle_t parent = arg;
+    short buf[64 * 2];
+
+    for (int i = 0; i < 50; i++) {
+        audio_stream_t *s;
+        if (audio_stream_open(PATH, &s) != ESP_OK) {
+            break;
+        }
+        audio_stream_read(s, buf, 64);
+        xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+        audio_stream_close(s);
+    }
+
+    xTaskNotifyGive(parent);
+    vTaskDelete(NULL);
+}
+static void test_close(void)
+{
+    xTaskCreate(close_task, "close", 8192, xTaskGetCurrentTaskHandle(), 5, NULL);
+    CHECK(ulTaskNotifyTake(pdTRUE, 10000 / portTICK_PERIOD_MS) == 1, "close task hung");
+}
+
+int main(void)
+{
+    test_read();
+    test_odd_fmt();
+    test_pcm8(1);
+    test_pcm8(2);
+    test_adpcm(1);
+    test_adpcm(2);
+    test_loop();
+
+    write_pcm16(16);
+    test_close();
+
+    remove(PATH);
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
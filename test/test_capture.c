@@ -0,0 +1,280 @@
+/* display_capture() BMPs of sources of any width, and capture streams of
+ * unaligned and indexed sources, read back. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "display_capture.h"
+
+#define STREAM_FRAMES (8)
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+// RGB565 value of a big endian pixel, through the palette if indexed
+static uint16_t pixel565(const gbuf_t *g, int x, int y)
+{
+    const uint8_t *p = g->data + y * g->stride + x * g->bytes_per_pixel;
+
+    if (g->bytes_per_pixel == 1) {
+        p = (const uint8_t *)&g->palette[*p];
+    }
+    return (p[0] << 8) | p[1];
+}
+
+// What a stream is expected to show after each frame, if known, and how
+// many rows the frame carries
+typedef struct {
+    int width;
+    int height;
+    int frames;
+    uint16_t *image[STREAM_FRAMES];
+    int rows[STREAM_FRAMES];
+} stream_t;
+
+// Capture a frame of src carrying rows rows. A complete frame brings the
+// stream up to src, a partial one only part of the way.
+static void capture_frame(stream_t *st, const gbuf_t *src, int rows, bool complete)
+{
+    uint16_t *image = NULL;
+
+    CHECK(display_capture_frame(src) == ESP_OK, "frame %d", st->frames);
+
+    if (complete) {
+        image = malloc(src->width * src->height * sizeof(uint16_t));
+        for (int y = 0; y < src->height; y++) {
+            for (int x = 0; x < src->width; x++) {
+                image[y * src->width + x] = pixel565(src, x, y);
+            }
+        }
+    }
+
+    st->width = src->width;
+    st->height = src->height;
+    st->image[st->frames] = image;
+    st->rows[st->frames] = rows;
+    st->frames++;
+}
+
+// Decode the stream at path frame by frame, as tools/capture_decode.py does,
+// and compare it with st
+static void check_stream(const char *path, stream_t *st, const char *what)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t header[8];
+
+    if (!f || fread(header, 1, 8, f) != 8 || memcmp(header, "FBC1", 4) != 0) {
+        CHECK(false, "%s: no stream header", what);
+        if (f) fclose(f);
+        return;
+    }
+    CHECK(get_le16(&header[4]) == st->width && get_le16(&header[6]) == st->height, "%s: stream size %dx%d",
+        what, get_le16(&header[4]), get_le16(&header[6]));
+
+    uint16_t *image = calloc(st->width * st->height, sizeof(uint16_t));
+    uint8_t *row = malloc(st->width * 2);
+    int frame = 0;
+
+    while (fread(header, 1, 6, f) == 6) {
+        int count = get_le16(&header[4]);
+        int rows = 0;
+
+        for (int i = 0; i < count; i++) {
+            uint8_t run[4];
+            if (fread(run, 1, 4, f) != 4) {
+                break;
+            }
+            int y = get_le16(&run[0]);
+            int lines = get_le16(&run[2]);
+            for (int line = 0; line < lines && y + line < st->height; line++) {
+                if (fread(row, 2, st->width, f) != st->width) {
+                    break;
+                }
+                for (int x = 0; x < st->width; x++) {
+                    image[(y + line) * st->width + x] = get_le16(&row[x * 2]);
+                }
+                rows++;
+            }
+        }
+
+        if (frame < st->frames) {
+            CHECK(rows == st->rows[frame], "%s: frame %d has %d rows, expected %d", what, frame, rows,
+                st->rows[frame]);
+            int bad = 0;
+            for (int i = 0; i < st->width * st->height && st->image[frame]; i++) {
+                bad += image[i] != st->image[frame][i];
+            }
+            CHECK(bad == 0, "%s: frame %d decodes with %d pixels off", what, frame, bad);
+        }
+        frame++;
+    }
+    CHECK(frame == st->frames, "%s: %d frames in the stream, %d captured", what, frame, st->frames);
+
+    fclose(f);
+    free(row);
+    free(image);
+    for (int i = 0; i < st->frames; i++) {
+        free(st->image[i]);
+    }
+}
+
+static void test_bmp(int width, int height)
+{
+    const char *path = "test_capture.bmp";
+    gbuf_t *src = gbuf_new(width, height, 2, BIG_ENDIAN);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *p = src->data + y * src->stride + x * 2;
+            p[0] = x;
+            p[1] = y * 3 + x;
+        }
+    }
+
+    CHECK(display_capture(src, path) == ESP_OK, "%dx%d capture", width, height);
+
+    FILE *f = fopen(path, "rb");
+    long size = 0;
+    uint8_t *bmp = NULL;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        size = ftell(f);
+        rewind(f);
+        bmp = malloc(size);
+        size = fread(bmp, 1, size, f);
+        fclose(f);
+    }
+    remove(path);
+
+    const int pitch = (width * 2 + 3) & ~3;
+    if (!bmp || size < 66) {
+        CHECK(false, "%dx%d no file", width, height);
+        free(bmp);
+        gbuf_free(src);
+        return;
+    }
+
+    uint32_t offset = get_le32(&bmp[10]);
+    CHECK(size == offset + pitch * height, "%dx%d file of %ld bytes", width, height, size);
+    CHECK(get_le32(&bmp[2]) == size, "%dx%d size field", width, height);
+    CHECK(get_le32(&bmp[34]) == pitch * height, "%dx%d image size field", width, height);
+
+    int bad = 0;
+    for (int y = 0; y < height && offset + pitch * height <= size; y++) {
+        const uint8_t *row = bmp + offset + y * pitch;
+        for (int x = 0; x < width; x++) {
+            const uint8_t *p = src->data + y * src->stride + x * 2;
+            bad += row[x * 2] != p[1] || row[x * 2 + 1] != p[0];
+        }
+    }
+    CHECK(bad == 0, "%dx%d %d pixels differ", width, height, bad);
+
+    free(bmp);
+    gbuf_free(src);
+}
+
+static void draw_stream_pattern(gbuf_t *g, int seed)
+{
+    for (int y = 0; y < g->height; y++) {
+        uint8_t *p = g->data + y * g->stride;
+        for (int x = 0; x < g->width * g->bytes_per_pixel; x++) {
+            p[x] = x * 5 + y * 17 + seed;
+        }
+    }
+}
+
+// A stream of src, changing single pixels at the start and at the very end
+// of rows: only those rows may be written, and each must be
+static void test_stream(gbuf_t *src, const char *what)
+{
+    const char *path = "test_capture.fbc";
+    const int w = src->width, h = src->height;
+    uint8_t *last = src->data + 5 * src->stride + (w - 1) * src->bytes_per_pixel;
+    stream_t st = { 0 };
+
+    CHECK(display_capture_start(path, h) == ESP_OK, "%s: stream start", what);
+
+    draw_stream_pattern(src, 0);
+    capture_frame(&st, src, h, true);
+    capture_frame(&st, src, 0, true);
+
+    // The last byte of a row, past its last full word
+    last[src->bytes_per_pixel - 1] ^= 0x40;
+    capture_frame(&st, src, 1, true);
+
+    src->data[0] ^= 0x01;
+    src->data[(h - 1) * src->stride + w / 2] ^= 0x80;
+    capture_frame(&st, src, 2, true);
+
+    if (src->bytes_per_pixel == 1) {
+        // Every row may show the changed color
+        src->palette[src->data[0]] ^= 0x0100;
+        capture_frame(&st, src, h, true);
+    }
+
+    CHECK(display_capture_stop() == ESP_OK, "%s: stream stop", what);
+    check_stream(path, &st, what);
+    remove(path);
+}
+
+// With a budget of 4 rows a frame, a full change takes ceil(height / 4)
+// frames to reach the stream
+static void test_stream_budget(void)
+{
+    const char *path = "test_capture.fbc";
+    gbuf_t *src = gbuf_new(24, 18, 2, BIG_ENDIAN);
+    stream_t st = { 0 };
+
+    CHECK(display_capture_start(path, 4) == ESP_OK, "budget: stream start");
+    draw_stream_pattern(src, 1);
+    for (int i = 0; i < 4; i++) {
+        capture_frame(&st, src, 4, false);
+    }
+    capture_frame(&st, src, 2, true);
+    capture_frame(&st, src, 0, true);
+    CHECK(display_capture_stop() == ESP_OK, "budget: stream stop");
+    check_stream(path, &st, "budget");
+
+    gbuf_free(src);
+    remove(path);
+}
+
+int main(void)
+{
+    test_bmp(320, 240);
+    test_bmp(321, 17);
+    test_bmp(641, 3);
+    test_bmp(1, 1);
+
+    // Screenshots while a capture stream is running, wider than the stream
+    CHECK(display_capture_start("test_capture.fbc", 240) == ESP_OK, "stream start");
+    test_bmp(641, 9);
+    test_bmp(33, 33);
+    display_capture_stop();
+    remove("test_capture.fbc");
+
+    // Views one pixel in have rows off word alignment, and odd widths leave
+    // bytes past the last word
+    gbuf_t *rgb = gbuf_new(38, 20, 2, BIG_ENDIAN);
+    gbuf_t rgb_view = gbuf_view(rgb, (rect_t){ 1, 0, 37, 20 });
+    test_stream(&rgb_view, "rgb16 view");
+    gbuf_t *indexed = gbuf_new(41, 12, 1, BIG_ENDIAN);
+    gbuf_t indexed_view = gbuf_view(indexed, (rect_t){ 3, 1, 37, 11 });
+    test_stream(&indexed_view, "indexed view");
+    test_stream_budget();
+    gbuf_free(indexed);
+    gbuf_free(rgb);
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
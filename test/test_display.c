@@ -0,0 +1,432 @@
+/* Regression tests of the present paths against the panel on the host's
+ * SPI bus: after each present, panel memory must show what was drawn. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+#include "check.h"
+#include "display.h"
+#include "display_host.h"
+#include "host_panel.h"
+
+// The panel under test: the ILI9341 model behind the SPI backend, or the
+// host backend's image
+static const display_backend_t *s_backend = NULL;
+static uint16_t (*s_panel_pixel)(short x, short y) = host_panel_pixel;
+
+static uint16_t fb_pixel(const gbuf_t *g, int x, int y)
+{
+    const uint8_t *p = g->data + y * g->stride + x * g->bytes_per_pixel;
+
+    if (g->bytes_per_pixel == 1) {
+        // Palette entries are big endian like the pixels
+        p = (const uint8_t *)&g->palette[*p];
+    }
+    return (p[0] << 8) | p[1];
+}
+
+// Panel pixel at logical (x, y) of the current orientation, through the
+// landscape view of the panel
+static uint16_t panel_pixel(display_orientation_t orientation, int x, int y)
+{
+    switch (orientation) {
+        case DISPLAY_PORTRAIT:
+            return s_panel_pixel(y, DISPLAY_HEIGHT - 1 - x);
+        default:
+            return s_panel_pixel(x, y);
+    }
+}
+
+static int count_mismatches(const gbuf_t *g, display_orientation_t orientation, rect_t r)
+{
+    int bad = 0;
+
+    for (int y = r.y; y < r.y + r.height; y++) {
+        for (int x = r.x; x < r.x + r.width; x++) {
+            bad += panel_pixel(orientation, x, y) != fb_pixel(g, x, y);
+        }
+    }
+    return bad;
+}
+
+static rect_t screen(void)
+{
+    return (rect_t){ 0, 0, display_width(), display_height() };
+}
+
+static void draw_pattern(gbuf_t *g, int seed)
+{
+    for (int y = 0; y < g->height; y++) {
+        uint8_t *p = g->data + y * g->stride;
+        for (int x = 0; x < g->width * g->bytes_per_pixel; x++) {
+            p[x] = (x * 7 + y * 13 + seed * 31) ^ (x >> 3);
+        }
+    }
+}
+
+// Presents submitted during the init delays queue behind the init job
+static void test_init_async(void)
+{
+    display_config_t config = DISPLAY_CONFIG_DEFAULT();
+    config.backend = s_backend;
+    display_fence_t init = display_init_async(&config);
+
+    draw_pattern(fb, 9);
+    display_update();
+    CHECK(display_poll(init), "present completed before init");
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "present behind init");
+}
+
+static void test_full(void)
+{
+    draw_pattern(fb, 1);
+    display_update();
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "full present");
+}
+
+static void test_clear(void)
+{
+    display_clear(0x1234);
+    int bad = 0;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            bad += s_panel_pixel(x, y) != 0x1234;
+        }
+    }
+    CHECK(bad == 0, "clear left %d pixels", bad);
+}
+
+static void test_rect_and_dirty(void)
+{
+    draw_pattern(fb, 2);
+    display_update();
+
+    // Only the rect reaches the panel
+    draw_pattern(fb, 3);
+    rect_t r = { 37, 21, 101, 55 };
+    display_update_rect(r);
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, r) == 0, "rect present");
+    CHECK(s_panel_pixel(0, 0) != fb_pixel(fb, 0, 0), "pixel outside the rect was sent");
+
+    rect_t full_width = { 0, 100, DISPLAY_WIDTH, 37 };
+    display_update_rect(full_width);
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, full_width) == 0, "full width rect present");
+
+    rect_t a = { 0, 0, 16, 16 };
+    rect_t b = { 300, 200, 20, 40 };
+    display_mark_dirty(a);
+    display_mark_dirty(b);
+    display_update_dirty();
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, a) == 0, "dirty rect a");
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, b) == 0, "dirty rect b");
+}
+
+static void test_modes(void)
+{
+    static const display_present_mode_t modes[] = {
+        DISPLAY_PRESENT_TILE_DIFF,
+        DISPLAY_PRESENT_LINE_DIFF,
+        DISPLAY_PRESENT_INTERLACED,
+    };
+
+    for (int i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        display_set_present_mode(modes[i]);
+
+        // The first diffed frame goes out whole, the interlaced one in two
+        draw_pattern(fb, 10 + i);
+        display_update();
+        display_update();
+        CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "mode %d first frame", modes[i]);
+
+        // A small change is all the diff modes send
+        rect_t r = { 40, 40, 8, 8 };
+        for (int y = r.y; y < r.y + r.height; y++) {
+            memset(fb->data + y * fb->stride + r.x * 2, 0xa5, r.width * 2);
+        }
+        display_update();
+        display_update();
+        CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "mode %d changed frame", modes[i]);
+
+        uint32_t sent;
+        display_get_frame_bytes(&sent, NULL);
+        if (modes[i] == DISPLAY_PRESENT_INTERLACED) {
+            CHECK(sent == DISPLAY_WIDTH * DISPLAY_HEIGHT, "interlaced field bytes %u", sent);
+        } else {
+            CHECK(sent == 0, "mode %d resent %u bytes of an unchanged frame", modes[i], sent);
+        }
+    }
+
+    display_set_present_mode(DISPLAY_PRESENT_FULL);
+}
+
+static void test_scaled(void)
+{
+    gbuf_t *src = gbuf_new(160, 120, 2, BIG_ENDIAN);
+    draw_pattern(src, 4);
+
+    display_update_scaled(src, DISPLAY_SCALE_INTEGER, true);
+
+    int bad = 0;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            bad += s_panel_pixel(x, y) != fb_pixel(src, x / 2, y / 2);
+        }
+    }
+    CHECK(bad == 0, "2x integer scale, %d pixels off", bad);
+
+    // Letterboxed with black borders
+    gbuf_t *narrow = gbuf_new(100, 120, 2, BIG_ENDIAN);
+    draw_pattern(narrow, 5);
+    display_update_scaled(narrow, DISPLAY_SCALE_INTEGER, true);
+    CHECK(s_panel_pixel(0, 0) == 0 && s_panel_pixel(319, 239) == 0, "letterbox borders");
+    CHECK(s_panel_pixel(60, 0) == fb_pixel(narrow, 0, 0), "letterboxed image origin");
+
+    // A present over the borders has them cleared by the next scaled one
+    memset(fb->data, 0xff, fb->stride * 8);
+    display_update_rect((rect_t){ 0, 0, DISPLAY_WIDTH, 8 });
+    display_update_scaled(narrow, DISPLAY_SCALE_INTEGER, true);
+    CHECK(s_panel_pixel(0, 0) == 0 && s_panel_pixel(319, 7) == 0, "borders cleared again");
+    CHECK(s_panel_pixel(60, 0) == fb_pixel(narrow, 0, 0), "image after borders");
+
+    gbuf_free(narrow);
+    gbuf_free(src);
+}
+
+static void test_indexed(void)
+{
+    gbuf_t *src = gbuf_new(160, 120, 1, BIG_ENDIAN);
+    draw_pattern(src, 6);
+
+    uint8_t *palette = (uint8_t *)src->palette;
+    for (int i = 0; i < GBUF_PALETTE_SIZE * 2; i++) {
+        palette[i] = i * 37 + 5;
+    }
+    display_update_scaled(src, DISPLAY_SCALE_INTEGER, true);
+
+    int bad = 0;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+        for (int x = 0; x < DISPLAY_WIDTH; x++) {
+            bad += s_panel_pixel(x, y) != fb_pixel(src, x / 2, y / 2);
+        }
+    }
+    CHECK(bad == 0, "indexed 2x scale, %d pixels off", bad);
+
+    // Only the palette changes
+    for (int i = 0; i < GBUF_PALETTE_SIZE * 2; i++) {
+        palette[i] = i * 11 + 1;
+    }
+    display_update_scaled(src, DISPLAY_SCALE_INTEGER, true);
+    CHECK(s_panel_pixel(0, 0) == fb_pixel(src, 0, 0) &&
+          s_panel_pixel(319, 239) == fb_pixel(src, 159, 119), "palette change");
+
+    gbuf_free(src);
+}
+
+static void test_formats(void)
+{
+    static const uint16_t formats[][2] = { { 3, BIG_ENDIAN }, { 4, BIG_ENDIAN }, { 2, LITTLE_ENDIAN } };
+
+    for (int i = 0; i < 3; i++) {
+        gbuf_t *src = gbuf_new(160, 120, formats[i][0], formats[i][1]);
+        draw_pattern(src, 7 + i);
+        display_update_scaled(src, DISPLAY_SCALE_INTEGER, true);
+
+        int bad = 0;
+        for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+            for (int x = 0; x < DISPLAY_WIDTH; x++) {
+                const uint8_t *p = src->data + (y / 2) * src->stride + (x / 2) * src->bytes_per_pixel;
+                uint16_t expected = src->bytes_per_pixel == 2 ? (p[1] << 8) | p[0] :
+                    ((p[0] & 0xf8) << 8) | ((p[1] & 0xfc) << 3) | (p[2] >> 3);
+                bad += s_panel_pixel(x, y) != expected;
+            }
+        }
+        CHECK(bad == 0, "%d bytes per pixel, %d pixels off", src->bytes_per_pixel, bad);
+
+        gbuf_free(src);
+    }
+}
+
+static void test_frame_queue(void)
+{
+    gbuf_t *frame = display_frames_init(2);
+
+    for (int i = 0; i < 5; i++) {
+        draw_pattern(frame, 20 + i);
+        gbuf_t *done = frame;
+        frame = display_frame_submit();
+        display_drain();
+        CHECK(count_mismatches(done, DISPLAY_LANDSCAPE, screen()) == 0, "queued frame %d", i);
+    }
+}
+
+static void test_view(void)
+{
+    draw_pattern(fb, 11);
+    display_update();
+
+    // Draw through a view, then present it scaled: both go through the stride
+    rect_t r = { 33, 17, 100, 60 };
+    gbuf_t view = gbuf_view(fb, r);
+    CHECK(!gbuf_packed(&view) && view.data == fb->data + r.y * fb->stride + r.x * 2, "view layout");
+
+    draw_pattern(&view, 12);
+    display_update_rect(r);
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "view drawn into fb");
+
+    display_update_scaled(&view, DISPLAY_SCALE_NEAREST, false);
+    CHECK(s_panel_pixel(0, 0) == fb_pixel(&view, 0, 0) &&
+          s_panel_pixel(319, 239) == fb_pixel(&view, 99, 59), "view presented scaled");
+}
+
+static void test_orientation(void)
+{
+    display_set_orientation(DISPLAY_PORTRAIT, false);
+    CHECK(display_width() == DISPLAY_HEIGHT && display_height() == DISPLAY_WIDTH, "portrait size");
+
+    draw_pattern(fb, 6);
+    display_update();
+    CHECK(count_mismatches(fb, DISPLAY_PORTRAIT, screen()) == 0, "portrait present");
+
+    display_set_orientation(DISPLAY_LANDSCAPE, false);
+    draw_pattern(fb, 7);
+    display_update();
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "landscape again");
+}
+
+// Scroll both ways, by more than the area and by nothing, presenting only
+// the exposed columns: the screen must keep showing fb. Mirrored, the panel
+// scrolls the other way round.
+static void test_scroll(void)
+{
+    static const short deltas[] = { 7, 1, -30, 200, -200, 259, 300, -1, 0 };
+
+    for (int mirror = 0; mirror < 2; mirror++) {
+        display_set_orientation(DISPLAY_LANDSCAPE, mirror);
+        draw_pattern(fb, 20);
+        display_scroll_define(40, 260);
+
+        int bad = 0;
+        for (int i = 0; i < sizeof(deltas) / sizeof(deltas[0]); i++) {
+            rect_t exposed = display_scroll(deltas[i]);
+            if (exposed.width > 0) {
+                gbuf_t view = gbuf_view(fb, exposed);
+                draw_pattern(&view, 21 + i);
+                display_update_rect(exposed);
+            } else {
+                CHECK(deltas[i] == 0, "nothing exposed by %d", deltas[i]);
+            }
+
+            for (int y = 0; y < DISPLAY_HEIGHT; y++) {
+                for (int x = 0; x < DISPLAY_WIDTH; x++) {
+                    bad += s_panel_pixel(mirror ? DISPLAY_WIDTH - 1 - x : x, y) != fb_pixel(fb, x, y);
+                }
+            }
+        }
+        CHECK(bad == 0, "%d pixels off after scrolling%s", bad, mirror ? " mirrored" : "");
+    }
+
+    display_scroll_define(0, 0);
+    display_set_orientation(DISPLAY_LANDSCAPE, false);
+    display_update();
+    CHECK(count_mismatches(fb, DISPLAY_LANDSCAPE, screen()) == 0, "scrolling turned off");
+}
+
+static void test_async(void)
+{
+    draw_pattern(fb, 8);
+    display_fence_t a = display_update_async();
+    display_fence_t b = display_clear_async(0);
+    display_wait(b);
+    CHECK(display_poll(a) && display_poll(b), "fences complete in order");
+}
+
+static void test_stats(void)
+{
+    display_reset_stats();
+
+    display_clear(0);
+    display_set_orientation(DISPLAY_LANDSCAPE, false);
+    display_update();
+    display_update_rect((rect_t){ 0, 0, 8, 8 });
+    display_mark_dirty((rect_t){ 8, 8, 8, 8 });
+    display_update_dirty();
+
+    display_stats_t stats;
+    display_get_stats(&stats);
+    CHECK(stats.frames == 3, "%u frames counted for 3 presents", stats.frames);
+}
+
+// Tasks submitting and waiting at the same time, more of them than there
+// are waiter bits
+#define WAIT_TASKS (12)
+#define WAIT_ROUNDS (200)
+
+static QueueHandle_t s_done;
+
+static void wait_task(void *arg)
+{
+    int id = (intptr_t)arg;
+    int late = 0;
+
+    for (int i = 0; i < WAIT_ROUNDS; i++) {
+        rect_t r = { id * 16, (i % 10) * 16, 16, 16 };
+        display_fence_t fence = display_update_rect_async(r);
+        display_wait(fence);
+        late += !display_poll(fence);
+    }
+
+    xQueueSend(s_done, &late, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+static void test_waiters(void)
+{
+    s_done = xQueueCreate(WAIT_TASKS, sizeof(int));
+
+    for (intptr_t i = 0; i < WAIT_TASKS; i++) {
+        xTaskCreate(wait_task, "wait", 4096, (void *)i, 5, NULL);
+    }
+
+    int late = 0;
+    for (int i = 0; i < WAIT_TASKS; i++) {
+        int n;
+        CHECK(xQueueReceive(s_done, &n, 10000 / portTICK_PERIOD_MS) == pdTRUE, "waiter %d hung", i);
+        late += n;
+    }
+    CHECK(late == 0, "%d waits returned before their fence", late);
+
+    vQueueDelete(s_done);
+}
+
+// Usage: test_display [host]
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "host") == 0) {
+        s_backend = &display_backend_host;
+        s_panel_pixel = display_host_pixel;
+    }
+
+    test_init_async();
+    test_full();
+    test_clear();
+    test_rect_and_dirty();
+    test_modes();
+    test_scaled();
+    test_indexed();
+    test_formats();
+    test_frame_queue();
+    test_view();
+    test_orientation();
+    test_scroll();
+    test_async();
+    test_waiters();
+    test_stats();
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
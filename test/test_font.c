@@ -0,0 +1,230 @@
+/* Text drawing against the glyph bitmaps: spans, clipping at every edge,
+ * line breaks, font_measure, and OGF1 files good, short and too large. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "font.h"
+
+#define INK (7)
+#define PAPER (1)
+
+/* '?', '@' and 'A', 9 pixels wide so rows take two bytes. '?' has a pixel
+ * in the ninth column, '@' is a frame with a gap in each side and 'A' is
+ * solid with a hole. */
+static const uint8_t s_widths[] = { 9, 10, 6 };
+static const uint8_t s_bitmap[] = {
+    // '?'
+    0x3c, 0x00, 0x42, 0x00, 0x02, 0x00, 0x0c, 0x00, 0x10, 0x00, 0x00, 0x00, 0x10, 0x80,
+    // '@'
+    0xf7, 0x80, 0x80, 0x80, 0x80, 0x00, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xff, 0x80,
+    // 'A'
+    0xfc, 0x00, 0xfc, 0x00, 0xcc, 0x00, 0xcc, 0x00, 0xfc, 0x00, 0xfc, 0x00, 0x00, 0x00,
+};
+
+static font_t s_font = {
+    .height = 7,
+    .first = '?',
+    .count = 3,
+    .max_width = 9,
+    .widths = s_widths,
+    .bitmap = s_bitmap,
+};
+
+static bool glyph_bit(const font_t *font, int glyph, int x, int y)
+{
+    const uint8_t *row = font->bitmap + (glyph * font->height + y) * ((font->max_width + 7) / 8);
+    return x < font->max_width && (row[x >> 3] & (0x80 >> (x & 7)));
+}
+
+// Draw text into expected the slow way, pixel by pixel from the bitmaps
+static void reference(gbuf_t *expected, const font_t *font, int x, int y, const char *text)
+{
+    int pen = x;
+
+    for (; *text; text++) {
+        if (*text == '\n') {
+            pen = x;
+            y += font->height;
+            continue;
+        }
+
+        int glyph = (uint8_t)*text - font->first;
+        if (glyph < 0 || glyph >= font->count) {
+            glyph = '?' - font->first;
+        }
+
+        for (int gy = 0; gy < font->height; gy++) {
+            for (int gx = 0; gx < font->max_width; gx++) {
+                int px = pen + gx, py = y + gy;
+                if (glyph_bit(font, glyph, gx, gy) && px >= 0 && py >= 0 && px < expected->width &&
+                    py < expected->height) {
+                    expected->data[py * expected->stride + px] = INK;
+                }
+            }
+        }
+        pen += font->widths[glyph];
+    }
+}
+
+static int draw_mismatches(font_t *font, int x, int y, const char *text, short *advance)
+{
+    gbuf_t *g = gbuf_new(40, 24, 1, BIG_ENDIAN);
+    gbuf_t *expected = gbuf_new(40, 24, 1, BIG_ENDIAN);
+    memset(g->data, PAPER, g->stride * g->height);
+    memset(expected->data, PAPER, expected->stride * expected->height);
+
+    reference(expected, font, x, y, text);
+    *advance = font_draw_string(g, font, x, y, text, INK);
+
+    int bad = 0;
+    for (int i = 0; i < g->stride * g->height; i++) {
+        bad += g->data[i] != expected->data[i];
+    }
+
+    gbuf_free(expected);
+    gbuf_free(g);
+    return bad;
+}
+
+static void test_draw(void)
+{
+    short advance;
+
+    CHECK(draw_mismatches(&s_font, 2, 3, "?@A", &advance) == 0, "glyphs drawn off their bitmaps");
+    CHECK(advance == 9 + 10 + 6, "advance %d", advance);
+
+    // Characters outside the font draw as '?'
+    CHECK(draw_mismatches(&s_font, 0, 0, "zA ", &advance) == 0, "fallback glyphs");
+    CHECK(advance == 9 + 6 + 9, "fallback advance %d", advance);
+
+    // Each line starts at x again, one font height lower
+    CHECK(draw_mismatches(&s_font, 5, 1, "A@\n?\nAA", &advance) == 0, "lines");
+    CHECK(advance == 12, "advance of the last line %d", advance);
+    CHECK(draw_mismatches(&s_font, 5, 1, "\n\n@", &advance) == 0, "empty lines");
+
+    // Clipped at every edge, and entirely outside
+    static const short positions[][2] = {
+        { -4, 2 }, { 3, -3 }, { 30, 5 }, { 12, 20 }, { -7, -5 }, { 35, 21 }, { -40, 0 }, { 0, 24 }, { 0, -30 },
+    };
+    int bad = 0;
+    for (int i = 0; i < sizeof(positions) / sizeof(positions[0]); i++) {
+        bad += draw_mismatches(&s_font, positions[i][0], positions[i][1], "@A?\nA@", &advance) != 0;
+    }
+    CHECK(bad == 0, "%d clipped strings off", bad);
+}
+
+static void test_rgb16(void)
+{
+    // Colors are native values, stored in the gbuf's endian
+    gbuf_t *g = gbuf_new(12, 8, 2, BIG_ENDIAN);
+    memset(g->data, 0, g->stride * g->height);
+
+    font_draw_string(g, &s_font, 0, 0, "A", 0xf81f);
+    const uint8_t *p = g->data;
+    CHECK(p[0] == 0xf8 && p[1] == 0x1f, "pixel %02x%02x", p[0], p[1]);
+    p = g->data + 2 * g->stride + 2 * 2;
+    CHECK(p[0] == 0 && p[1] == 0, "hole drawn");
+
+    gbuf_free(g);
+}
+
+static void test_measure(void)
+{
+    short width, height;
+
+    font_measure(&s_font, "", &width, &height);
+    CHECK(width == 0 && height == 7, "empty text %dx%d", width, height);
+
+    font_measure(&s_font, "A@?", &width, &height);
+    CHECK(width == 25 && height == 7, "one line %dx%d", width, height);
+
+    // The widest line counts, whichever it is
+    font_measure(&s_font, "A\n@@\n?", &width, &height);
+    CHECK(width == 20 && height == 21, "three lines %dx%d", width, height);
+
+    font_measure(&s_font, "x\n", &width, NULL);
+    font_measure(&s_font, "x\n", NULL, &height);
+    CHECK(width == 9 && height == 14, "fallback and trailing newline %dx%d", width, height);
+}
+
+static bool write_file(const char *path, const uint8_t *header, const uint8_t *data, size_t size)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(header, 1, 8, f) == 8 && fwrite(data, 1, size, f) == size;
+    return fclose(f) == 0 && ok;
+}
+
+static void test_load(void)
+{
+    const char *path = "test_font.ogf";
+    uint8_t header[8] = { 'O', 'G', 'F', '1', 7, '?', 3, 9 };
+    uint8_t data[sizeof(s_widths) + sizeof(s_bitmap)];
+    memcpy(data, s_widths, sizeof(s_widths));
+    memcpy(data + sizeof(s_widths), s_bitmap, sizeof(s_bitmap));
+
+    CHECK(write_file(path, header, data, sizeof(data)), "can't write %s", path);
+    font_t *font = font_load(path);
+    CHECK(font != NULL, "font not loaded");
+    if (font) {
+        CHECK(font->height == 7 && font->first == '?' && font->count == 3 && font->max_width == 9, "header");
+        CHECK(memcmp(font->widths, s_widths, sizeof(s_widths)) == 0, "widths");
+        CHECK(memcmp(font->bitmap, s_bitmap, sizeof(s_bitmap)) == 0, "bitmaps");
+
+        short advance;
+        CHECK(draw_mismatches(font, 1, 2, "A?\n@", &advance) == 0, "loaded font drawn off");
+        font_free(font);
+    }
+
+    // Cut short in the bitmaps
+    write_file(path, header, data, sizeof(data) - 1);
+    CHECK(font_load(path) == NULL, "short file loaded");
+
+    header[3] = '2';
+    write_file(path, header, data, sizeof(data));
+    CHECK(font_load(path) == NULL, "wrong magic loaded");
+
+    // Three checkered 255x255 glyphs hold 3 * 255 * 128 spans, more than the
+    // glyph cache indexes
+    uint8_t big_header[8] = { 'O', 'G', 'F', '1', 255, 'A', 3, 255 };
+    size_t big_size = 3 + 3 * 255 * 32;
+    uint8_t *big = malloc(big_size);
+    memset(big, 0xaa, big_size);
+    write_file(path, big_header, big, big_size);
+    CHECK(font_load(path) == NULL, "font over the span limit loaded");
+
+    // One of them is within it
+    big_header[6] = 1;
+    write_file(path, big_header, big, 1 + 255 * 32);
+    font = font_load(path);
+    CHECK(font != NULL, "font within the span limit refused");
+    if (font) {
+        gbuf_t *g = gbuf_new(255, 255, 1, BIG_ENDIAN);
+        memset(g->data, PAPER, g->stride * g->height);
+        font_draw_string(g, font, 0, 0, "A", INK);
+        CHECK(g->data[0] == INK && g->data[1] != INK && g->data[254 * g->stride + 254] == INK, "big glyph");
+        gbuf_free(g);
+        font_free(font);
+    }
+
+    free(big);
+    remove(path);
+    CHECK(font_load(path) == NULL, "missing file loaded");
+}
+
+int main(void)
+{
+    test_draw();
+    test_rgb16();
+    test_measure();
+    test_load();
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
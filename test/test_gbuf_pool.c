@@ -0,0 +1,206 @@
+/* gbuf pools and arenas: reuse of released gbufs, the fallback to larger
+ * classes once the block is used up, arena resets and the stats, plus a
+ * random churn checking that live gbufs never overlap. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "gbuf_pool.h"
+#include "platform.h"
+
+#define CHURN_LIVE (40)
+#define CHURN_ROUNDS (20000)
+
+static gbuf_pool_stats_t stats_of(const gbuf_pool_t *pool)
+{
+    gbuf_pool_stats_t stats;
+    gbuf_pool_get_stats(pool, &stats);
+    return stats;
+}
+
+static void test_alloc_release(void)
+{
+    gbuf_pool_t *pool = gbuf_pool_new(64 * 1024, MALLOC_CAP_8BIT, false);
+    CHECK(pool != NULL, "pool not created");
+
+    gbuf_t *a = gbuf_pool_alloc(pool, 16, 16, 2, BIG_ENDIAN);
+    CHECK(a && a->width == 16 && a->height == 16 && a->bytes_per_pixel == 2 && a->endian == BIG_ENDIAN,
+        "gbuf not set up");
+    memset(a->data, 0xa5, a->stride * a->height);
+
+    gbuf_pool_stats_t s = stats_of(pool);
+    CHECK(s.size == 64 * 1024 && s.live == 1 && s.top == s.in_use, "stats after one alloc");
+    CHECK(s.requested >= gbuf_size(16, 16, 2) && s.in_use >= s.requested, "%zu requested, %zu in use",
+        s.requested, s.in_use);
+    // Classes a quarter power of two apart waste at most a fifth
+    CHECK(s.requested * 5 >= s.in_use * 4, "%zu bytes for %zu requested", s.in_use, s.requested);
+    CHECK(s.fragmentation == 0.0f && s.failures == 0, "nothing free listed yet");
+
+    const size_t block = s.in_use;
+    gbuf_pool_release(pool, a);
+    s = stats_of(pool);
+    CHECK(s.live == 0 && s.in_use == 0 && s.requested == 0, "stats after release");
+    CHECK(s.free_listed == block && s.top == block && s.high_water == block, "released block is free listed");
+    CHECK(s.fragmentation > 0.0f, "free listed memory counts as fragmented");
+
+    // The same class gets the block back, also for a slightly different size
+    gbuf_t *b = gbuf_pool_alloc(pool, 17, 15, 2, LITTLE_ENDIAN);
+    CHECK(b == a && b->width == 17 && b->endian == LITTLE_ENDIAN, "released block not reused");
+    s = stats_of(pool);
+    CHECK(s.free_listed == 0 && s.top == block && s.in_use == block, "stats after reuse");
+
+    // A larger class is cut from the unused end
+    gbuf_t *c = gbuf_pool_alloc(pool, 64, 64, 2, BIG_ENDIAN);
+    CHECK(c && (uint8_t *)c >= (uint8_t *)b + block, "larger gbuf overlaps");
+    CHECK(stats_of(pool).live == 2, "two live gbufs");
+
+    gbuf_pool_release(pool, b);
+    gbuf_pool_release(pool, c);
+    gbuf_pool_release(pool, NULL);
+    CHECK(stats_of(pool).live == 0, "all released");
+
+    gbuf_pool_free(pool);
+}
+
+static void test_fallback(void)
+{
+    gbuf_pool_t *pool = gbuf_pool_new(8 * 1024, MALLOC_CAP_8BIT, false);
+
+    gbuf_t *big = gbuf_pool_alloc(pool, 40, 40, 2, BIG_ENDIAN);
+    const size_t big_block = stats_of(pool).in_use;
+
+    // Small gbufs until the unused end runs out
+    gbuf_t *small[64];
+    int count = 0;
+    while (count < 64 && (small[count] = gbuf_pool_alloc(pool, 8, 8, 2, BIG_ENDIAN))) {
+        count++;
+    }
+    CHECK(count > 0 && count < 64 && stats_of(pool).failures == 1, "%d small gbufs fit", count);
+
+    // With its own class empty, a small request takes the big free block
+    gbuf_pool_release(pool, big);
+    gbuf_t *g = gbuf_pool_alloc(pool, 8, 8, 2, BIG_ENDIAN);
+    gbuf_pool_stats_t s = stats_of(pool);
+    CHECK(g == big, "no fallback to the larger free block");
+    CHECK(s.failures == 1 && s.free_listed == 0, "fallback counted as a failure");
+    CHECK(s.live == count + 1, "%u live", s.live);
+
+    // It keeps its size, and returns to its own class
+    gbuf_pool_release(pool, g);
+    s = stats_of(pool);
+    CHECK(s.free_listed == big_block, "%zu bytes free listed, block has %zu", s.free_listed, big_block);
+    g = gbuf_pool_alloc(pool, 40, 40, 2, BIG_ENDIAN);
+    CHECK(g == big, "big block not back in its class");
+
+    // Smaller free blocks do not serve larger requests
+    gbuf_pool_release(pool, small[0]);
+    CHECK(gbuf_pool_alloc(pool, 20, 20, 2, BIG_ENDIAN) == NULL, "larger request served");
+    CHECK(stats_of(pool).failures == 2, "failure not counted");
+
+    gbuf_pool_free(pool);
+}
+
+static void test_arena(void)
+{
+    gbuf_pool_t *arena = gbuf_pool_new(16 * 1024, MALLOC_CAP_8BIT, true);
+
+    gbuf_t *a = gbuf_pool_alloc(arena, 10, 3, 1, BIG_ENDIAN);
+    gbuf_pool_stats_t s = stats_of(arena);
+    CHECK(s.in_use == s.top && s.in_use - s.requested < 8, "arena rounds %zu to %zu", s.requested, s.in_use);
+    CHECK(a->palette != NULL, "indexed gbuf without palette");
+
+    gbuf_t *b = gbuf_pool_alloc(arena, 33, 7, 2, BIG_ENDIAN);
+    CHECK((uint8_t *)b - (uint8_t *)a == s.top, "arena gbufs not packed");
+
+    // Release does nothing, reset frees everything
+    gbuf_pool_release(arena, a);
+    s = stats_of(arena);
+    CHECK(s.live == 2 && s.free_listed == 0, "release changed the arena");
+
+    const size_t peak = s.in_use;
+    gbuf_pool_reset(arena);
+    s = stats_of(arena);
+    CHECK(s.live == 0 && s.in_use == 0 && s.requested == 0 && s.top == 0, "stats after reset");
+    CHECK(s.high_water == peak, "reset lost the high water mark");
+
+    CHECK(gbuf_pool_alloc(arena, 10, 3, 1, BIG_ENDIAN) == a, "arena not reused from the start");
+    CHECK(gbuf_pool_alloc(arena, 200, 200, 2, BIG_ENDIAN) == NULL, "oversized request served");
+    CHECK(stats_of(arena).failures == 1, "failure not counted");
+
+    gbuf_pool_free(arena);
+}
+
+// Fill g with its own byte, so a gbuf written over another shows
+static void stamp(gbuf_t *g, uint8_t id)
+{
+    for (int y = 0; y < g->height; y++) {
+        memset(g->data + y * g->stride, id, g->width * g->bytes_per_pixel);
+    }
+}
+
+static bool stamped(const gbuf_t *g, uint8_t id)
+{
+    for (int y = 0; y < g->height; y++) {
+        const uint8_t *p = g->data + y * g->stride;
+        for (int x = 0; x < g->width * g->bytes_per_pixel; x++) {
+            if (p[x] != id) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_churn(void)
+{
+    gbuf_pool_t *pool = gbuf_pool_new(96 * 1024, MALLOC_CAP_8BIT, false);
+    gbuf_t *live[CHURN_LIVE] = { NULL };
+    int corrupted = 0, failures = 0;
+
+    srand(3);
+    for (int i = 0; i < CHURN_ROUNDS; i++) {
+        int k = rand() % CHURN_LIVE;
+        if (live[k]) {
+            corrupted += !stamped(live[k], k + 1);
+            gbuf_pool_release(pool, live[k]);
+        }
+
+        int side = rand() % 16 ? 4 + rand() % 40 : 60 + rand() % 40;
+        live[k] = gbuf_pool_alloc(pool, side, 4 + rand() % 40, 1 + rand() % 2, BIG_ENDIAN);
+        if (live[k]) {
+            stamp(live[k], k + 1);
+        } else {
+            failures++;
+        }
+    }
+
+    int n = 0;
+    for (int k = 0; k < CHURN_LIVE; k++) {
+        if (live[k]) {
+            corrupted += !stamped(live[k], k + 1);
+            n++;
+        }
+    }
+
+    gbuf_pool_stats_t s = stats_of(pool);
+    CHECK(corrupted == 0, "%d gbufs overwritten", corrupted);
+    CHECK(s.live == n && s.failures == failures, "%u live, %u failures", s.live, s.failures);
+    CHECK(s.in_use >= s.requested && s.high_water >= s.in_use && s.top <= s.size, "stats out of range");
+    CHECK(s.top == s.in_use + s.free_listed, "%zu cut, %zu in use, %zu free listed", s.top, s.in_use,
+        s.free_listed);
+
+    gbuf_pool_free(pool);
+}
+
+int main(void)
+{
+    test_alloc_release();
+    test_fallback();
+    test_arena();
+    test_churn();
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+/* raster.h primitives against per-pixel references: fills at every
+ * alignment, blits and blends clipped on both buffers, overlapping blits
+ * within one gbuf and the keyed blit. Each check compares the whole
+ * destination, so pixels written outside the clipped rect are caught too. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "raster.h"
+
+// Pixel value as raster.h takes colors: an index, or RGB565 whatever the
+// endian the gbuf stores it in
+static uint32_t get(const gbuf_t *g, int x, int y)
+{
+    const uint8_t *p = g->data + y * g->stride + x * g->bytes_per_pixel;
+
+    if (g->bytes_per_pixel == 1) {
+        return p[0];
+    }
+    return g->endian == BIG_ENDIAN ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+static void put(gbuf_t *g, int x, int y, uint32_t c)
+{
+    uint8_t *p = g->data + y * g->stride + x * g->bytes_per_pixel;
+
+    if (g->bytes_per_pixel == 1) {
+        p[0] = c;
+    } else if (g->endian == BIG_ENDIAN) {
+        p[0] = c >> 8;
+        p[1] = c;
+    } else {
+        p[0] = c;
+        p[1] = c >> 8;
+    }
+}
+
+static void draw_pattern(gbuf_t *g, int seed)
+{
+    for (int y = 0; y < g->height; y++) {
+        for (int x = 0; x < g->width; x++) {
+            put(g, x, y, (x * 7 + y * 131 + seed * 31) ^ (x << 9) ^ seed);
+        }
+    }
+}
+
+static gbuf_t *copy(const gbuf_t *g)
+{
+    gbuf_t *c = gbuf_new(g->width, g->height, g->bytes_per_pixel, g->endian);
+    for (int y = 0; y < g->height; y++) {
+        memcpy(c->data + y * c->stride, g->data + y * g->stride, g->width * g->bytes_per_pixel);
+    }
+    return c;
+}
+
+static int count_mismatches(const gbuf_t *a, const gbuf_t *b)
+{
+    int bad = 0;
+
+    for (int y = 0; y < a->height; y++) {
+        for (int x = 0; x < a->width; x++) {
+            bad += get(a, x, y) != get(b, x, y);
+        }
+    }
+    return bad;
+}
+
+static rect_t s_damage;
+static int s_damage_count;
+
+static void record_damage(const gbuf_t *g, rect_t r, void *arg)
+{
+    s_damage = r;
+    s_damage_count++;
+}
+
+static bool inside(rect_t r, int x, int y)
+{
+    return x >= r.x && y >= r.y && x < r.x + r.width && y < r.y + r.height;
+}
+
+// Per-channel floor average of two RGB565 colors
+static uint32_t average565(uint32_t a, uint32_t b)
+{
+    uint32_t r = (((a >> 11) & 0x1f) + ((b >> 11) & 0x1f)) >> 1;
+    uint32_t g = (((a >> 5) & 0x3f) + ((b >> 5) & 0x3f)) >> 1;
+    uint32_t bl = ((a & 0x1f) + (b & 0x1f)) >> 1;
+    return (r << 11) | (g << 5) | bl;
+}
+
+typedef enum { BLIT, BLIT_KEY, BLEND_HALF } op_t;
+
+// What op does to expected, reading src as it was before the call: source
+// pixel (sx, sy) of src_rect lands at at + (sx, sy) - src_rect origin, when
+// it is inside both buffers
+static void reference(op_t op, gbuf_t *expected, point_t at, const gbuf_t *src, rect_t src_rect, uint32_t key)
+{
+    rect_t src_bounds = { 0, 0, src->width, src->height };
+
+    for (int y = 0; y < expected->height; y++) {
+        for (int x = 0; x < expected->width; x++) {
+            int sx = src_rect.x + x - at.x;
+            int sy = src_rect.y + y - at.y;
+            if (!inside(src_rect, sx, sy) || !inside(src_bounds, sx, sy)) {
+                continue;
+            }
+
+            uint32_t c = get(src, sx, sy);
+            switch (op) {
+                case BLIT:
+                    put(expected, x, y, c);
+                    break;
+                case BLIT_KEY:
+                    if (c != key) {
+                        put(expected, x, y, c);
+                    }
+                    break;
+                case BLEND_HALF:
+                    put(expected, x, y, average565(get(expected, x, y), c));
+                    break;
+            }
+        }
+    }
+}
+
+static void run(op_t op, gbuf_t *dst, point_t at, const gbuf_t *src, rect_t src_rect, uint32_t key)
+{
+    switch (op) {
+        case BLIT:
+            raster_blit(dst, at, src, src_rect);
+            break;
+        case BLIT_KEY:
+            raster_blit_key(dst, at, src, src_rect, key);
+            break;
+        case BLEND_HALF:
+            raster_blend_half(dst, at, src, src_rect);
+            break;
+    }
+}
+
+static void test_fill(int bytes_per_pixel, int endian)
+{
+    gbuf_t *g = gbuf_new(37, 9, bytes_per_pixel, endian);
+    const uint32_t color = bytes_per_pixel == 1 ? 0x5a : 0xbeef;
+    int bad = 0;
+
+    // Every start alignment and short, odd and long widths, plus rects
+    // reaching past each edge
+    for (int x = -2; x < 6; x++) {
+        for (int width = 1; width < 34; width += width < 8 ? 1 : 7) {
+            rect_t r = { x, 1 + x % 3, width, 1 + width % 5 };
+
+            draw_pattern(g, x + width);
+            gbuf_t *expected = copy(g);
+            for (int y = 0; y < g->height; y++) {
+                for (int px = 0; px < g->width; px++) {
+                    if (inside(r, px, y)) {
+                        put(expected, px, y, color);
+                    }
+                }
+            }
+
+            raster_fill_rect(g, r, color);
+            bad += count_mismatches(g, expected) != 0;
+            gbuf_free(expected);
+        }
+    }
+    CHECK(bad == 0, "%d bpp %s: %d fills off", bytes_per_pixel, endian == BIG_ENDIAN ? "be" : "le", bad);
+
+    gbuf_free(g);
+}
+
+// Blits of src_rect at at, with src_rect and at reaching past every edge of
+// both buffers
+static void test_clipped(op_t op, int bytes_per_pixel, int endian)
+{
+    gbuf_t *src = gbuf_new(16, 12, bytes_per_pixel, endian);
+    gbuf_t *dst = gbuf_new(24, 20, bytes_per_pixel, endian);
+    const uint32_t key = get(src, 0, 0);
+    static const rect_t rects[] = {
+        { 2, 3, 9, 5 },
+        { -3, -2, 10, 10 },
+        { 10, 8, 10, 10 },
+        { -4, -4, 30, 30 },
+        { 1, -5, 3, 8 },
+    };
+    static const point_t ats[] = { { 0, 0 }, { 5, 7 }, { -3, -2 }, { 19, 17 }, { -6, 12 }, { 1, 1 } };
+    int bad = 0, bad_damage = 0;
+
+    draw_pattern(src, 1);
+    // Some key colored pixels for the keyed blit, runs and single ones
+    for (int y = 0; y < src->height; y++) {
+        for (int x = 0; x < src->width; x++) {
+            if ((x + y) % 5 < 2 || x == 7) {
+                put(src, x, y, key);
+            }
+        }
+    }
+
+    raster_register_damage_callback(record_damage, NULL);
+    for (int i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+        for (int j = 0; j < sizeof(ats) / sizeof(ats[0]); j++) {
+            draw_pattern(dst, 2 + i + j);
+            gbuf_t *expected = copy(dst);
+            gbuf_t *untouched = copy(dst);
+            reference(op, expected, ats[j], src, rects[i], key);
+
+            s_damage_count = 0;
+            run(op, dst, ats[j], src, rects[i], key);
+            if (count_mismatches(dst, expected)) {
+                printf("  op %d rect %d at (%d, %d)\n", op, i, ats[j].x, ats[j].y);
+                bad++;
+            }
+
+            // The damage covers every changed pixel
+            for (int y = 0; y < dst->height; y++) {
+                for (int x = 0; x < dst->width; x++) {
+                    if (get(dst, x, y) != get(untouched, x, y) && (!s_damage_count || !inside(s_damage, x, y))) {
+                        bad_damage++;
+                    }
+                }
+            }
+
+            gbuf_free(untouched);
+            gbuf_free(expected);
+        }
+    }
+    raster_register_damage_callback(NULL, NULL);
+
+    CHECK(bad == 0, "op %d, %d bpp %s: %d clipped cases off", op, bytes_per_pixel,
+        endian == BIG_ENDIAN ? "be" : "le", bad);
+    CHECK(bad_damage == 0, "op %d: %d changed pixels outside the damage", op, bad_damage);
+
+    gbuf_free(dst);
+    gbuf_free(src);
+}
+
+// A buffer blitted onto itself in every direction, directly and through
+// overlapping views
+static void test_overlap(int bytes_per_pixel)
+{
+    gbuf_t *g = gbuf_new(40, 30, bytes_per_pixel, BIG_ENDIAN);
+    int bad = 0;
+
+    for (int dy = -3; dy <= 3; dy++) {
+        for (int dx = -3; dx <= 3; dx++) {
+            rect_t r = { 6, 5, 21, 17 };
+            point_t at = { r.x + dx, r.y + dy };
+
+            draw_pattern(g, dx * 7 + dy);
+            gbuf_t *before = copy(g);
+            gbuf_t *expected = copy(g);
+            reference(BLIT, expected, at, before, r, 0);
+
+            raster_blit(g, at, g, r);
+            bad += count_mismatches(g, expected) != 0;
+
+            // Views of the two rects, which overlap in g
+            draw_pattern(g, dx * 7 + dy);
+            gbuf_t from = gbuf_view(g, r);
+            gbuf_t to = gbuf_view(g, (rect_t){ at.x, at.y, r.width, r.height });
+            raster_blit(&to, (point_t){ 0, 0 }, &from, (rect_t){ 0, 0, r.width, r.height });
+            bad += count_mismatches(g, expected) != 0;
+
+            gbuf_free(expected);
+            gbuf_free(before);
+        }
+    }
+    CHECK(bad == 0, "%d bpp: %d overlapping blits off", bytes_per_pixel, bad);
+
+    gbuf_free(g);
+}
+
+int main(void)
+{
+    test_fill(1, BIG_ENDIAN);
+    test_fill(2, BIG_ENDIAN);
+    test_fill(2, LITTLE_ENDIAN);
+
+    test_clipped(BLIT, 1, BIG_ENDIAN);
+    test_clipped(BLIT, 2, BIG_ENDIAN);
+    test_clipped(BLIT_KEY, 1, BIG_ENDIAN);
+    test_clipped(BLIT_KEY, 2, BIG_ENDIAN);
+    test_clipped(BLIT_KEY, 2, LITTLE_ENDIAN);
+    test_clipped(BLEND_HALF, 2, BIG_ENDIAN);
+    test_clipped(BLEND_HALF, 2, LITTLE_ENDIAN);
+
+    test_overlap(1);
+    test_overlap(2);
+
+    printf("%s: %d failures\n", __FILE__, s_failures);
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Decode a display_capture_start() stream into numbered PPM frames.
+
+Stream format, all values little endian:
+  header: "FBC1", uint16 width, uint16 height
+  frame:  uint32 time in ms since the start, uint16 run count
+  run:    uint16 y, uint16 lines, then lines * width RGB565 pixels
+
+Each run replaces rows of the previous frame, the first frames start from
+black.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+
+def rgb565_to_rgb888(row):
+    out = bytearray(len(row) // 2 * 3)
+    for i, (c,) in enumerate(struct.iter_unpack("<H", row)):
+        r, g, b = c >> 11, (c >> 5) & 0x3F, c & 0x1F
+        out[i * 3 : i * 3 + 3] = bytes(((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2)))
+    return bytes(out)
+
+
+def read_exact(f, size):
+    data = f.read(size)
+    if len(data) != size:
+        raise EOFError
+    return data
+
+
+def decode(path, out_dir, prefix):
+    with open(path, "rb") as f:
+        magic, width, height = struct.unpack("<4sHH", read_exact(f, 8))
+        if magic != b"FBC1":
+            sys.exit("%s: not a capture stream" % path)
+
+        black = bytes(width * 3)
+        rows = [black] * height
+        frame = 0
+
+        while True:
+            try:
+                time_ms, count = struct.unpack("<IH", read_exact(f, 6))
+                for _ in range(count):
+                    y, lines = struct.unpack("<HH", read_exact(f, 4))
+                    for line in range(y, y + lines):
+                        rows[line] = rgb565_to_rgb888(read_exact(f, width * 2))
+            except EOFError:
+                break
+
+            name = os.path.join(out_dir, "%s%05d.ppm" % (prefix, frame))
+            with open(name, "wb") as out:
+                out.write(b"P6\n%d %d\n255\n" % (width, height))
+                out.writelines(rows)
+            print("%s %d ms, %d runs" % (name, time_ms, count))
+            frame += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("stream")
+    parser.add_argument("-o", "--out-dir", default=".")
+    parser.add_argument("-p", "--prefix", default="frame")
+    args = parser.parse_args()
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    decode(args.stream, args.out_dir, args.prefix)
+
+
+if __name__ == "__main__":
+    main()